@@ -1,33 +1,576 @@
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
 #include <llvm/ExecutionEngine/Orc/CompileUtils.h>
 #include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
 #include <llvm/ExecutionEngine/Orc/IRTransformLayer.h>
 #include <llvm/ExecutionEngine/Orc/ObjectTransformLayer.h>
 #include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/CodeGen/MachinePassRegistry.h>
+#include <llvm/CodeGen/RegAllocRegistry.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/JSON.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <thread>
+#include <unordered_map>
+#include <vector>
+#include <dlfcn.h>
+#include <exception>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// The unwind info registration of libgcc, which takes the start of an .eh_frame section
+extern "C" void __register_frame(void*);
+extern "C" void __deregister_frame(void*);
 
 // Container for JIT-ed code. The generated code is very simple, we generate the equivalent of
 // int foo(int(*bar)(int), int v) { return bar(v); }
 // We just want to trigger the libgcc code path for JITed code and check if unwinding though
 // generate code works
 class JITContainer {
+   public:
+   // The time spent setting up the JIT, and materializing the code, i.e., compiling, linking and registering it. The
+   // registration of the unwind info is part of materializing
+   struct Timings {
+      uint64_t setupNs = 0, materializeNs = 0, registerNs = 0;
+   };
+
    private:
    struct JIT;
+   class AccountingMemoryManager;
 
    using CallbackSignature = int (*)(int);
    using Signature = int (*)(CallbackSignature, int);
    std::unique_ptr<JIT> jit;
    Signature jitedCode;
+   Timings timings;
+
+   void compile(llvm::orc::ThreadSafeContext context, std::unique_ptr<llvm::Module>&& module, std::unique_ptr<llvm::MemoryBuffer>&& object, const char* entry = "foo", bool useObjectCache = true);
 
    public:
    JITContainer();
+   // Compile a module and look up its entry point. invoke can only be used if the entry point is foo. Without
+   // useObjectCache, the module is compiled even if the configured object cache has its object
+   JITContainer(std::unique_ptr<llvm::LLVMContext>&& context, std::unique_ptr<llvm::Module>&& module, const char* entry = "foo", bool useObjectCache = true);
+   // Link a relocatable object that contains foo, skipping IR and the compile layer
+   explicit JITContainer(std::unique_ptr<llvm::MemoryBuffer>&& object);
    ~JITContainer();
 
    int invoke(CallbackSignature callback, int v) const { return jitedCode(callback, v); }
+   // The number of bytes allocated for code, data and unwind info
+   size_t getAllocatedSize() const;
+   // The number of bytes reserved from the operating system for them, which is rounded to pages
+   size_t getReservedSize() const;
+   // The .eh_frame sections that were registered for the generated code
+   const std::vector<uint8_t*>& getEHFrames() const;
+   // Is the address inside the generated code?
+   bool containsCode(const void* address) const;
+   const Timings& getTimings() const { return timings; }
+
+   // Generate the IR for foo. Different fragments have different IR, but behave identically
+   static std::unique_ptr<llvm::Module> generateModule(llvm::LLVMContext& context, unsigned fragment = 0);
+   // Compile foo into a relocatable object
+   static std::unique_ptr<llvm::MemoryBuffer> compileObject(unsigned fragment = 0);
+   // Look up the object of foo in the configured object cache, nullptr if there is none
+   static std::unique_ptr<llvm::MemoryBuffer> loadCachedObject(unsigned fragment = 0);
+
+   // Generate a vectorizable kernel that computes the sum of squares of n integers, n must be a multiple of 16
+   // int kernel(const int* data, int n)
+   static std::unique_ptr<llvm::Module> generateKernel(llvm::LLVMContext& context);
+   // Generate the functions f0 to f<functions-1> with the signature of foo. The functions form chains of chainLength
+   // calls, i.e., the first function of a chain calls its successor, and the last one calls the callback
+   static std::unique_ptr<llvm::Module> generateChains(llvm::LLVMContext& context, unsigned functions, unsigned chainLength);
+   // Generate a foo that calls the callback with 65536 / v. Without an explicit check, v == 0 traps with SIGFPE, and
+   // the function has asynchronous unwind tables to unwind from the faulting instruction. With the check, v == 0
+   // calls the callback with 0, which throws
+   static std::unique_ptr<llvm::Module> generateDivision(llvm::LLVMContext& context, bool explicitCheck);
+   // Look up a symbol in the generated code
+   void* getSymbol(const char* name) const;
+
+   // Settings that apply to all containers created afterwards
+   struct Config {
+      // The cache that is queried before compiling, if any
+      llvm::ObjectCache* objectCache = nullptr;
+      // The target cpu and features, "native" selects the host cpu and its features
+      std::string cpu;
+      std::vector<std::string> features;
+      // The code generation settings. GlobalISel falls back to SelectionDAG for unsupported code
+      llvm::CodeGenOpt::Level optLevel = llvm::CodeGenOpt::Default;
+      bool fastISel = false, globalISel = false;
+      // Record the time spent in each pass
+      bool timePasses = false;
+      // Record the section sizes of the generated objects
+      bool accountSizes = false;
+   };
+   static Config config;
+   // Apply the target settings
+   static void configureTarget(llvm::EngineBuilder& builder);
+   // Select the fast register allocator instead of the default one for the optimization level. This is a global LLVM
+   // option, thus it must not be changed while other threads compile code
+   static void setFastRegisterAllocator(bool fast);
+   // Set or reset (value nullptr) a global LLVM code generation option, with the same restrictions
+   static void setCodegenOption(const char* name, const char* value);
+   // Describe all settings that influence the generated code, i.e., the target, the configured code generation
+   // settings, and the global LLVM options that were set. Code caches must include this in their keys
+   static std::string describeSettings();
+
+   private:
+   // The global LLVM options that are currently set
+   static std::map<std::string, std::string> codegenOptions;
+};
+
+JITContainer::Config JITContainer::config;
+std::map<std::string, std::string> JITContainer::codegenOptions;
+
+// Detects threads that spend too long in the unwinder. Every thread publishes a heartbeat and the phase it is in, and
+// a watchdog thread records the threads that have been inside a throw, a registration or a deregistration for longer
+// than the threshold. Optionally, the watchdog interrupts a stalled thread with a signal to capture where it is. The
+// handler only records the interrupted instruction, as unwinding the stack from there could deadlock on the unwinder
+// lock that the thread may hold
+class Watchdog {
+   public:
+   enum Phase : unsigned { Idle, Throw, Register, Deregister, PhaseCount };
+
+   private:
+   // The state of a thread, published to the watchdog
+   struct Slot {
+      std::atomic<bool> used{false};
+      // Held while the slot is released, and by the watchdog while it signals the thread. Thus a thread that is
+      // signaled has not released its slot yet, and receives the signal before it can do so
+      std::mutex exitMutex;
+      pthread_t thread;
+      // Incremented whenever the thread enters a phase
+      std::atomic<uint64_t> heartbeat{0};
+      std::atomic<unsigned> phase{Idle};
+      std::atomic<uint64_t> phaseStart{0};
+      // The instruction that was interrupted by the stack capture signal
+      std::atomic<uintptr_t> capturedPc{0};
+   };
+   // A stall detected by the watchdog while it was in progress
+   struct Event {
+      Phase phase;
+      unsigned slot;
+      uint64_t observedNs;
+      uintptr_t pc;
+   };
+   // Releases the slot of a thread when it exits
+   struct ThreadSlot {
+      Slot* slot = nullptr;
+      ~ThreadSlot() {
+         if (!slot) return;
+         std::unique_lock<std::mutex> lock(slot->exitMutex);
+         slot->used = false;
+         slot = nullptr;
+      }
+   };
+
+   static constexpr unsigned slotCount = 4096;
+   static constexpr unsigned bucketCount = 16;
+   static constexpr int captureSignal = SIGUSR2;
+   static Slot slots[slotCount];
+   static thread_local ThreadSlot threadSlot;
+   static std::mutex mutex;
+   static std::vector<Event> events;
+   // Completed phases that exceeded the threshold, in power of two buckets of milliseconds
+   static uint64_t histogram[PhaseCount][bucketCount];
+   static std::atomic<bool> done;
+   static std::thread watcher;
+
+   static uint64_t now() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+   static Slot* getSlot();
+   static void captureHandler(int, siginfo_t*, void* context);
+   static void watch();
+
+   public:
+   static bool enabled;
+   static uint64_t thresholdNs;
+   static bool captureStacks;
+
+   // Marks a phase of the current thread, if the watchdog is enabled
+   class Scope {
+      Slot* slot = nullptr;
+      uint64_t start;
+      Phase phase;
+
+      public:
+      explicit Scope(Phase phase);
+      ~Scope();
+   };
+
+   // Start and stop the watchdog thread
+   static void start(uint64_t thresholdMs, bool stacks);
+   static void stop();
+   // Print the stall histogram and the first detected stalls
+   static void report();
+};
+
+Watchdog::Slot Watchdog::slots[Watchdog::slotCount];
+thread_local Watchdog::ThreadSlot Watchdog::threadSlot;
+std::mutex Watchdog::mutex;
+std::vector<Watchdog::Event> Watchdog::events;
+uint64_t Watchdog::histogram[Watchdog::PhaseCount][Watchdog::bucketCount];
+std::atomic<bool> Watchdog::done{false};
+std::thread Watchdog::watcher;
+bool Watchdog::enabled = false;
+uint64_t Watchdog::thresholdNs = 0;
+bool Watchdog::captureStacks = false;
+
+Watchdog::Slot* Watchdog::getSlot() {
+   if (threadSlot.slot) return threadSlot.slot;
+   // Claim a free slot, threads beyond the capacity are not tracked
+   for (auto& s : slots) {
+      bool expected = false;
+      if (s.used.compare_exchange_strong(expected, true)) {
+         s.thread = pthread_self();
+         s.phase = Idle;
+         return threadSlot.slot = &s;
+      }
+   }
+   return nullptr;
+}
+
+Watchdog::Scope::Scope(Phase phase) : phase(phase) {
+   // Idle scopes are not tracked, which keeps the watchdog off the path of calls that do not throw
+   if ((!enabled) || (phase == Idle)) return;
+   slot = getSlot();
+   if (!slot) return;
+   start = now();
+   slot->phaseStart.store(start, std::memory_order_relaxed);
+   slot->phase.store(phase, std::memory_order_relaxed);
+   slot->heartbeat.fetch_add(1, std::memory_order_release);
+}
+
+Watchdog::Scope::~Scope() {
+   if (!slot) return;
+   slot->phase.store(Idle, std::memory_order_release);
+   uint64_t duration = now() - start;
+   if (duration < thresholdNs) return;
+   unsigned bucket = 0;
+   for (uint64_t ms = duration / 1000000; ms && (bucket + 1 < bucketCount); ms >>= 1) ++bucket;
+   std::unique_lock<std::mutex> lock(mutex);
+   ++histogram[phase][bucket];
+}
+
+void Watchdog::captureHandler(int, siginfo_t*, void* context) {
+   uintptr_t pc = 0;
+#if defined(__x86_64__)
+   pc = static_cast<ucontext_t*>(context)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+   pc = static_cast<ucontext_t*>(context)->uc_mcontext.pc;
+#endif
+   if (threadSlot.slot) threadSlot.slot->capturedPc.store(pc ? pc : 1, std::memory_order_release);
+}
+
+void Watchdog::watch() {
+   std::vector<uint64_t> reported(slotCount, 0);
+   auto interval = std::chrono::nanoseconds(std::max<uint64_t>(thresholdNs / 4, 100000));
+   while (!done.load()) {
+      std::this_thread::sleep_for(interval);
+      uint64_t t = now();
+      for (unsigned index = 0; index != slotCount; ++index) {
+         auto& s = slots[index];
+         if (!s.used.load(std::memory_order_relaxed)) continue;
+         uint64_t heartbeat = s.heartbeat.load(std::memory_order_acquire);
+         unsigned phase = s.phase.load(std::memory_order_relaxed);
+         uint64_t since = s.phaseStart.load(std::memory_order_relaxed);
+         if ((phase == Idle) || (heartbeat == reported[index]) || (t < since + thresholdNs)) continue;
+         reported[index] = heartbeat;
+
+         // Interrupt the thread to capture where it is, if it is still in the same phase
+         uintptr_t pc = 0;
+         if (captureStacks) {
+            s.capturedPc = 0;
+            std::unique_lock<std::mutex> lock(s.exitMutex);
+            if (s.used.load() && (s.heartbeat.load() == heartbeat) && (pthread_kill(s.thread, captureSignal) == 0))
+               for (unsigned spin = 0; (spin != 1000) && (!(pc = s.capturedPc.load(std::memory_order_acquire))); ++spin) std::this_thread::sleep_for(std::chrono::microseconds(10));
+         }
+         std::unique_lock<std::mutex> lock(mutex);
+         events.push_back({static_cast<Phase>(phase), index, t - since, pc});
+      }
+   }
+}
+
+void Watchdog::start(uint64_t thresholdMs, bool stacks) {
+   thresholdNs = thresholdMs * 1000000;
+   captureStacks = stacks;
+   if (stacks) {
+      struct sigaction action;
+      memset(&action, 0, sizeof(action));
+      action.sa_sigaction = captureHandler;
+      action.sa_flags = SA_SIGINFO | SA_RESTART;
+      sigemptyset(&action.sa_mask);
+      sigaction(captureSignal, &action, nullptr);
+   }
+   enabled = true;
+   watcher = std::thread(watch);
+}
+
+void Watchdog::stop() {
+   if (!enabled) return;
+   done = true;
+   watcher.join();
+   enabled = false;
+}
+
+void Watchdog::report() {
+   const char* names[] = {"idle", "throw", "register", "deregister"};
+   std::unique_lock<std::mutex> lock(mutex);
+   std::cout << "watchdog: " << events.size() << " stalls over " << (thresholdNs / 1000000) << "ms detected in progress" << std::endl;
+   for (unsigned phase = Throw; phase != PhaseCount; ++phase) {
+      uint64_t total = 0;
+      for (auto c : histogram[phase]) total += c;
+      std::cout << "  " << names[phase] << ": " << total << " completed stalls";
+      for (unsigned bucket = 0; bucket != bucketCount; ++bucket)
+         if (histogram[phase][bucket]) std::cout << ", " << (bucket ? (1ull << (bucket - 1)) : 0) << "-" << (1ull << bucket) << "ms: " << histogram[phase][bucket];
+      std::cout << std::endl;
+   }
+   constexpr unsigned shown = 10;
+   for (unsigned index = 0; (index != events.size()) && (index != shown); ++index) {
+      auto& e = events[index];
+      std::cout << "  thread slot " << e.slot << " in " << names[e.phase] << " for at least " << (e.observedNs / 1000000.0) << "ms";
+      if (e.pc) {
+         Dl_info info;
+         if (dladdr(reinterpret_cast<void*>(e.pc), &info) && info.dli_sname)
+            std::cout << ", at " << info.dli_sname << "+0x" << std::hex << (e.pc - reinterpret_cast<uintptr_t>(info.dli_saddr)) << std::dec;
+         else if (dladdr(reinterpret_cast<void*>(e.pc), &info) && info.dli_fname)
+            std::cout << ", in " << info.dli_fname;
+         else
+            std::cout << ", at 0x" << std::hex << e.pc << std::dec << " (JIT code)";
+      }
+      std::cout << std::endl;
+   }
+}
+
+// A memory mapper that keeps track of the memory reserved from the operating system
+class CountingMemoryMapper : public llvm::SectionMemoryManager::MemoryMapper {
+   public:
+   size_t reservedSize = 0;
+
+   llvm::sys::MemoryBlock allocateMappedMemory(llvm::SectionMemoryManager::AllocationPurpose, size_t size, const llvm::sys::MemoryBlock* const nearBlock, unsigned flags, std::error_code& ec) override {
+      auto block = llvm::sys::Memory::allocateMappedMemory(size, nearBlock, flags, ec);
+      reservedSize += block.allocatedSize();
+      return block;
+   }
+   std::error_code protectMappedMemory(const llvm::sys::MemoryBlock& block, unsigned flags) override { return llvm::sys::Memory::protectMappedMemory(block, flags); }
+   std::error_code releaseMappedMemory(llvm::sys::MemoryBlock& block) override { return llvm::sys::Memory::releaseMappedMemory(block); }
+};
+
+// Holds the mapper, which must outlive the SectionMemoryManager base class
+struct MemoryMapperHolder {
+   CountingMemoryMapper mapper;
+};
+
+// A memory manager that keeps track of the allocated sections, and of the memory reserved for them
+class JITContainer::AccountingMemoryManager : private MemoryMapperHolder, public llvm::SectionMemoryManager {
+   public:
+   size_t allocatedSize = 0;
+   uint64_t registerNs = 0;
+   std::vector<uint8_t*> ehFrames;
+   // The start and size of the code sections
+   std::vector<std::pair<uint8_t*, uintptr_t>> codeSections;
+
+   AccountingMemoryManager() : SectionMemoryManager(&mapper) {}
+   size_t getReservedSize() const { return mapper.reservedSize; }
+
+   uint8_t* allocateCodeSection(uintptr_t size, unsigned alignment, unsigned sectionID, llvm::StringRef sectionName) override {
+      allocatedSize += size;
+      uint8_t* code = SectionMemoryManager::allocateCodeSection(size, alignment, sectionID, sectionName);
+      codeSections.push_back({code, size});
+      return code;
+   }
+   uint8_t* allocateDataSection(uintptr_t size, unsigned alignment, unsigned sectionID, llvm::StringRef sectionName, bool isReadOnly) override {
+      allocatedSize += size;
+      return SectionMemoryManager::allocateDataSection(size, alignment, sectionID, sectionName, isReadOnly);
+   }
+   void registerEHFrames(uint8_t* addr, uint64_t loadAddr, size_t size) override {
+      Watchdog::Scope scope(Watchdog::Register);
+      auto start = std::chrono::steady_clock::now();
+      SectionMemoryManager::registerEHFrames(addr, loadAddr, size);
+      ehFrames.push_back(addr);
+      registerNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+   }
+   void deregisterEHFrames() override {
+      Watchdog::Scope scope(Watchdog::Deregister);
+      SectionMemoryManager::deregisterEHFrames();
+   }
+};
+
+// Aggregated code size statistics over all containers
+class CodeSizes {
+   public:
+   // The section sizes of an object
+   struct Sections {
+      uint64_t text = 0, ehFrame = 0, exceptTable = 0;
+   };
+
+   private:
+   static std::mutex mutex;
+   static Sections sections;
+   static uint64_t containers, used, reserved;
+
+   public:
+   // Parse the sections of an object
+   static Sections parseSections(const llvm::MemoryBuffer& object);
+   // Record the sizes of a container
+   static void record(const Sections& s, uint64_t usedBytes, uint64_t reservedBytes);
+   // Print the per-container averages and the total waste
+   static void report();
+};
+
+std::mutex CodeSizes::mutex;
+CodeSizes::Sections CodeSizes::sections;
+uint64_t CodeSizes::containers = 0, CodeSizes::used = 0, CodeSizes::reserved = 0;
+
+CodeSizes::Sections CodeSizes::parseSections(const llvm::MemoryBuffer& object) {
+   Sections result;
+   auto file = llvm::object::ObjectFile::createObjectFile(object.getMemBufferRef());
+   if (!file) {
+      llvm::consumeError(file.takeError());
+      return result;
+   }
+   for (auto& section : (*file)->sections()) {
+      auto name = section.getName();
+      if (!name) {
+         llvm::consumeError(name.takeError());
+         continue;
+      }
+      if (name->startswith(".text"))
+         result.text += section.getSize();
+      else if (*name == ".eh_frame")
+         result.ehFrame += section.getSize();
+      else if (name->startswith(".gcc_except_table"))
+         result.exceptTable += section.getSize();
+   }
+   return result;
+}
+
+void CodeSizes::record(const Sections& s, uint64_t usedBytes, uint64_t reservedBytes) {
+   std::unique_lock<std::mutex> lock(mutex);
+   ++containers;
+   sections.text += s.text;
+   sections.ehFrame += s.ehFrame;
+   sections.exceptTable += s.exceptTable;
+   used += usedBytes;
+   reserved += reservedBytes;
+}
+
+void CodeSizes::report() {
+   std::unique_lock<std::mutex> lock(mutex);
+   if (!containers) return;
+   auto avg = [&](uint64_t v) { return static_cast<double>(v) / containers; };
+   std::cout << "code sizes over " << containers << " containers, average .text " << avg(sections.text) << " bytes, .eh_frame " << avg(sections.ehFrame) << " bytes, .gcc_except_table " << avg(sections.exceptTable)
+             << " bytes, allocated " << avg(used) << " bytes, reserved " << avg(reserved) << " bytes, total waste " << (reserved - used) << " bytes (" << (100.0 * (reserved - used) / reserved) << "%)" << std::endl;
+}
+
+// Hands out the contexts for new modules. By default every module gets its own context, otherwise the modules are
+// assigned round-robin to a pool of shared contexts. IR generation, adding the module to the JIT (which scans its
+// symbols), code generation, and destroying the module hold the lock of the context, thus the time spent waiting for
+// these locks is recorded for shared contexts
+class ContextPool {
+   static std::vector<llvm::orc::ThreadSafeContext> contexts;
+   static std::atomic<unsigned> next;
+   static std::atomic<uint64_t> acquisitions, waitNs, maxWaitNs;
+
+   public:
+   // Use a pool of the given size, 0 gives every module its own context
+   static void configure(unsigned size);
+   static unsigned size() { return contexts.size(); }
+   // Get the context for a new module
+   static llvm::orc::ThreadSafeContext get();
+   // Lock a context and record the wait time
+   static llvm::orc::ThreadSafeContext::Lock lock(const llvm::orc::ThreadSafeContext& context);
+   // Record a wait for a context lock that was taken elsewhere
+   static void recordWait(uint64_t ns);
+   // Reset and print the lock statistics
+   static void reset();
+   static uint64_t getWaitNs() { return waitNs.load(); }
+   static void report();
+};
+
+std::vector<llvm::orc::ThreadSafeContext> ContextPool::contexts;
+std::atomic<unsigned> ContextPool::next{0};
+std::atomic<uint64_t> ContextPool::acquisitions{0}, ContextPool::waitNs{0}, ContextPool::maxWaitNs{0};
+
+void ContextPool::configure(unsigned size) {
+   contexts.clear();
+   for (unsigned index = 0; index != size; ++index) contexts.emplace_back(std::make_unique<llvm::LLVMContext>());
+}
+
+llvm::orc::ThreadSafeContext ContextPool::get() {
+   if (contexts.empty()) return llvm::orc::ThreadSafeContext(std::make_unique<llvm::LLVMContext>());
+   return contexts[next.fetch_add(1) % contexts.size()];
+}
+
+llvm::orc::ThreadSafeContext::Lock ContextPool::lock(const llvm::orc::ThreadSafeContext& context) {
+   // Private contexts are never contended
+   if (contexts.empty()) return context.getLock();
+   auto start = std::chrono::steady_clock::now();
+   auto lock = context.getLock();
+   recordWait(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+   return lock;
+}
+
+void ContextPool::recordWait(uint64_t ns) {
+   if (contexts.empty()) return;
+   ++acquisitions;
+   waitNs += ns;
+   uint64_t current = maxWaitNs.load();
+   while ((ns > current) && (!maxWaitNs.compare_exchange_weak(current, ns))) {}
+}
+
+void ContextPool::reset() {
+   acquisitions = 0;
+   waitNs = 0;
+   maxWaitNs = 0;
+}
+
+void ContextPool::report() {
+   uint64_t count = acquisitions.load();
+   std::cout << "context locks: " << count << " acquisitions, waited " << (waitNs.load() / 1000000.0) << "ms in total, " << (count ? waitNs.load() / 1000.0 / count : 0) << "us on average, at most "
+             << (maxWaitNs.load() / 1000.0) << "us" << std::endl;
+}
+
+// Compiles a module, and records how long the compile layer waited for the context lock of the module. The optimize
+// layer hands the module over right before the compile layer locks the context
+class TimedCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+   llvm::orc::SimpleCompiler compiler;
+   const std::chrono::steady_clock::time_point& handedOver;
+
+   public:
+   TimedCompiler(llvm::TargetMachine& targetMachine, llvm::ObjectCache* cache, const std::chrono::steady_clock::time_point& handedOver)
+      : IRCompiler(llvm::orc::irManglingOptionsFromTargetOptions(targetMachine.Options)), compiler(targetMachine, cache), handedOver(handedOver) {}
+
+   llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> operator()(llvm::Module& module) override {
+      if (ContextPool::size()) ContextPool::recordWait(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - handedOver).count());
+      return compiler(module);
+   }
 };
 
 // The interface to LLVM
@@ -35,214 +578,2965 @@ struct JITContainer::JIT {
    llvm::orc::ThreadSafeContext context;
    std::unique_ptr<llvm::TargetMachine> targetMachine;
    llvm::orc::ExecutionSession es;
+   AccountingMemoryManager* memoryManager = nullptr;
+   // The section sizes of the object, if accounted
+   CodeSizes::Sections sections;
    llvm::orc::RTDyldObjectLinkingLayer objectLayer;
    llvm::orc::ObjectTransformLayer objectTransformLayer;
    llvm::orc::IRCompileLayer compileLayer;
    llvm::orc::IRTransformLayer optimizeLayer;
    llvm::orc::JITDylib& mainDylib;
+   // When the last module was handed over to the compile layer
+   std::chrono::steady_clock::time_point handedOver;
 
-   JIT(std::unique_ptr<llvm::LLVMContext>&& context, std::unique_ptr<llvm::Module>&& module, llvm::EngineBuilder& builder)
-      : context(move(context)),
+   JIT(llvm::orc::ThreadSafeContext context, llvm::EngineBuilder& builder, llvm::ObjectCache* objectCache)
+      : context(std::move(context)),
         targetMachine(builder.selectTarget()),
         es(std::make_unique<llvm::orc::UnsupportedExecutorProcessControl>()),
-        objectLayer(es, []() { return std::make_unique<llvm::SectionMemoryManager>(); }),
+        objectLayer(es, [this]() {
+           auto mm = std::make_unique<AccountingMemoryManager>();
+           memoryManager = mm.get();
+           return mm;
+        }),
         objectTransformLayer(es, objectLayer),
-        compileLayer(es, objectTransformLayer, std::make_unique<llvm::orc::SimpleCompiler>(*targetMachine)),
-        optimizeLayer(es, compileLayer, [](llvm::orc::ThreadSafeModule m, const llvm::orc::MaterializationResponsibility&) { return m; }),
+        compileLayer(es, objectTransformLayer, std::make_unique<TimedCompiler>(*targetMachine, objectCache, handedOver)),
+        optimizeLayer(es, compileLayer, [this](llvm::orc::ThreadSafeModule m, const llvm::orc::MaterializationResponsibility&) {
+           handedOver = std::chrono::steady_clock::now();
+           return m;
+        }),
         mainDylib(cantFail(es.createJITDylib("exe"))) {
-      llvm::cantFail(optimizeLayer.add(mainDylib, llvm::orc::ThreadSafeModule(move(module), this->context)));
+      // Destroy the compiled module under a recorded lock, the module would otherwise lock its context when it is released
+      compileLayer.setNotifyCompiled([](llvm::orc::MaterializationResponsibility&, llvm::orc::ThreadSafeModule m) {
+         auto lock = ContextPool::lock(m.getContext());
+         m = llvm::orc::ThreadSafeModule();
+      });
+      if (config.accountSizes)
+         objectTransformLayer.setTransform([this](std::unique_ptr<llvm::MemoryBuffer> object) -> llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> {
+            sections = CodeSizes::parseSections(*object);
+            return object;
+         });
    }
    ~JIT() { llvm::cantFail(es.endSession()); }
+   void add(std::unique_ptr<llvm::Module>&& module) {
+      // Adding the module locks its context to scan the symbols, take the lock ourselves to record the wait
+      auto lock = ContextPool::lock(context);
+      llvm::cantFail(optimizeLayer.add(mainDylib, llvm::orc::ThreadSafeModule(move(module), context)));
+   }
+   void add(std::unique_ptr<llvm::MemoryBuffer>&& object) { llvm::cantFail(objectTransformLayer.add(mainDylib, move(object))); }
    void* dlsym(const char* name) {
       auto sym = es.lookup(&mainDylib, name);
-      return (sym) ? reinterpret_cast<void*>(static_cast<uintptr_t>(sym->getAddress())) : nullptr;
+      if (!sym) {
+         llvm::consumeError(sym.takeError());
+         return nullptr;
+      }
+      return reinterpret_cast<void*>(static_cast<uintptr_t>(sym->getAddress()));
    }
 };
 
-JITContainer::JITContainer() {
+// The types of the callback, int callback(int v), and of foo, int foo(int (*callback)(int), int v)
+struct FooTypes {
+   llvm::FunctionType* callback;
+   llvm::FunctionType* foo;
+};
+
+static FooTypes getFooTypes(llvm::LLVMContext& c) {
+   auto it = llvm::Type::getInt32Ty(c);
+   llvm::Type* callbackArgs[1] = {it};
+   auto callback = llvm::FunctionType::get(it, callbackArgs, false);
+   llvm::Type* fooArgs[2] = {callback->getPointerTo(), it};
+   return {callback, llvm::FunctionType::get(it, fooArgs, false)};
+}
+
+std::unique_ptr<llvm::Module> JITContainer::generateModule(llvm::LLVMContext& c, unsigned fragment) {
    // Generate the IR code for foo
-   auto c = std::make_unique<llvm::LLVMContext>();
-   auto m = std::make_unique<llvm::Module>("module", *c);
-   auto it = llvm::Type::getInt32Ty(*c);
-   llvm::Type* args1[1] = {it};
-   auto ft1 = llvm::FunctionType::get(it, args1, false);
-   llvm::Type* args2[2] = {ft1->getPointerTo(), it};
-   auto ft2 = llvm::FunctionType::get(it, args2, false);
-   auto f = llvm::Function::Create(ft2, llvm::Function::ExternalLinkage, "foo", &*m);
+   auto m = std::make_unique<llvm::Module>("module", c);
+   auto it = llvm::Type::getInt32Ty(c);
+   auto types = getFooTypes(c);
+   auto f = llvm::Function::Create(types.foo, llvm::Function::ExternalLinkage, "foo", &*m);
    {
       auto callback = f->getArg(0);
       auto v = f->getArg(1);
-      auto b = llvm::BasicBlock::Create(*c, "body", f);
-      llvm::IRBuilder<> builder(*c);
+      auto b = llvm::BasicBlock::Create(c, "body", f);
+      llvm::IRBuilder<> builder(c);
       builder.SetInsertPoint(b);
       llvm::Value* args[1] = {v};
-      auto call = builder.CreateCall(ft1, callback, args);
+      auto call = builder.CreateCall(types.callback, callback, args);
       builder.CreateRet(call);
    }
 
-   // Compile into machine code
+   // Tag other fragments to make their IR distinct
+   if (fragment) new llvm::GlobalVariable(*m, it, true, llvm::GlobalValue::ExternalLinkage, llvm::ConstantInt::get(it, fragment), "fragment");
+   return m;
+}
+
+std::unique_ptr<llvm::MemoryBuffer> JITContainer::compileObject(unsigned fragment) {
+   llvm::LLVMContext c;
+   auto m = generateModule(c, fragment);
    llvm::EngineBuilder engineBuilder;
-   jit = std::make_unique<JIT>(move(c), move(m), engineBuilder);
-   jitedCode = reinterpret_cast<Signature>(jit->dlsym("foo"));
+   configureTarget(engineBuilder);
+   std::unique_ptr<llvm::TargetMachine> targetMachine(engineBuilder.selectTarget());
+   m->setDataLayout(targetMachine->createDataLayout());
+   return llvm::cantFail(llvm::orc::SimpleCompiler(*targetMachine)(*m));
 }
 
-JITContainer::~JITContainer() {
+std::unique_ptr<llvm::MemoryBuffer> JITContainer::loadCachedObject(unsigned fragment) {
+   if (!config.objectCache) return nullptr;
+   llvm::LLVMContext c;
+   auto m = generateModule(c, fragment);
+   return config.objectCache->getObject(m.get());
 }
 
-// The callback function that we use. Throws on input<1
-static int callback(int v) {
-   if (v < 1) throw v;
-   if (v & 1) return 3 * v + 1;
-   return v / 2;
+std::unique_ptr<llvm::Module> JITContainer::generateKernel(llvm::LLVMContext& c) {
+   constexpr unsigned width = 16;
+   auto m = std::make_unique<llvm::Module>("kernel", c);
+   auto it = llvm::Type::getInt32Ty(c);
+   auto vt = llvm::FixedVectorType::get(it, width);
+   llvm::Type* args[2] = {it->getPointerTo(), it};
+   auto f = llvm::Function::Create(llvm::FunctionType::get(it, args, false), llvm::Function::ExternalLinkage, "kernel", &*m);
+   auto data = f->getArg(0), n = f->getArg(1);
+   auto entry = llvm::BasicBlock::Create(c, "entry", f), loop = llvm::BasicBlock::Create(c, "loop", f), exit = llvm::BasicBlock::Create(c, "exit", f);
+   llvm::IRBuilder<> builder(c);
+   builder.SetInsertPoint(entry);
+   builder.CreateBr(loop);
+
+   // Process 16 values per iteration using vector instructions, which are legalized for the target ISA
+   builder.SetInsertPoint(loop);
+   auto i = builder.CreatePHI(it, 2), acc = builder.CreatePHI(vt, 2);
+   auto ptr = builder.CreateBitCast(builder.CreateGEP(it, data, i), vt->getPointerTo());
+   auto v = builder.CreateAlignedLoad(vt, ptr, llvm::Align(4));
+   auto nextAcc = builder.CreateAdd(acc, builder.CreateMul(v, v));
+   auto nextI = builder.CreateAdd(i, llvm::ConstantInt::get(it, width));
+   i->addIncoming(llvm::ConstantInt::get(it, 0), entry);
+   i->addIncoming(nextI, loop);
+   acc->addIncoming(llvm::Constant::getNullValue(vt), entry);
+   acc->addIncoming(nextAcc, loop);
+   builder.CreateCondBr(builder.CreateICmpSLT(nextI, n), loop, exit);
+
+   builder.SetInsertPoint(exit);
+   builder.CreateRet(builder.CreateAddReduce(nextAcc));
+   return m;
 }
 
-// A helper function for tests. Checks that we get the expected output
-static bool doTest(const JITContainer& jitCode, int input, int expected) {
-   try {
-      int r = jitCode.invoke(callback, input);
-      if ((r < 0) || (r != expected)) {
-         std::cerr << "unexpected result for input " << input << ", expected " << expected << ", got " << r << std::endl;
-         exit(1);
-      }
-   } catch (int) {
-      if (expected >= 0) {
-         std::cerr << "unexpected result for input " << input << ", expected " << expected << ", got exception" << std::endl;
-         exit(1);
+std::unique_ptr<llvm::Module> JITContainer::generateChains(llvm::LLVMContext& c, unsigned functions, unsigned chainLength) {
+   auto m = std::make_unique<llvm::Module>("chains", c);
+   auto types = getFooTypes(c);
+   std::vector<llvm::Function*> fs;
+   for (unsigned index = 0; index != functions; ++index) {
+      fs.push_back(llvm::Function::Create(types.foo, llvm::Function::ExternalLinkage, "f" + std::to_string(index), &*m));
+      fs.back()->addFnAttr(llvm::Attribute::NoInline);
+   }
+
+   llvm::IRBuilder<> builder(c);
+   for (unsigned index = 0; index != functions; ++index) {
+      auto f = fs[index];
+      auto callback = f->getArg(0);
+      auto v = f->getArg(1);
+      builder.SetInsertPoint(llvm::BasicBlock::Create(c, "body", f));
+      // The calls are not marked as tail calls, thus every function keeps its frame on the stack when unwinding
+      llvm::Value* call;
+      if (((index + 1) % chainLength) && (index + 1 < functions)) {
+         llvm::Value* args[2] = {callback, v};
+         call = builder.CreateCall(types.foo, fs[index + 1], args);
+      } else {
+         llvm::Value* args[1] = {v};
+         call = builder.CreateCall(types.callback, callback, args);
       }
+      builder.CreateRet(call);
    }
-   return true;
+   return m;
 }
 
-// Sanity test to check the generated code works as intended
-static void sanityTest(const JITContainer& jitCode) {
-   doTest(jitCode, 2, 1);
-   doTest(jitCode, 1, 4);
-   doTest(jitCode, 0, -1);
-   doTest(jitCode, -1, -1);
+std::unique_ptr<llvm::Module> JITContainer::generateDivision(llvm::LLVMContext& c, bool explicitCheck) {
+   auto m = std::make_unique<llvm::Module>("division", c);
+   auto it = llvm::Type::getInt32Ty(c);
+   auto types = getFooTypes(c);
+   auto f = llvm::Function::Create(types.foo, llvm::Function::ExternalLinkage, "foo", &*m);
+   f->addFnAttr(llvm::Attribute::UWTable);
+   auto callback = f->getArg(0);
+   auto v = f->getArg(1);
+   llvm::IRBuilder<> builder(c);
+   auto body = llvm::BasicBlock::Create(c, "body", f);
+   if (explicitCheck) {
+      auto entry = llvm::BasicBlock::Create(c, "entry", f, body), fail = llvm::BasicBlock::Create(c, "fail", f);
+      builder.SetInsertPoint(entry);
+      builder.CreateCondBr(builder.CreateICmpEQ(v, llvm::ConstantInt::get(it, 0)), fail, body);
+      builder.SetInsertPoint(fail);
+      llvm::Value* args[1] = {llvm::ConstantInt::get(it, 0)};
+      builder.CreateRet(builder.CreateCall(types.callback, callback, args));
+   }
+   builder.SetInsertPoint(body);
+   llvm::Value* args[1] = {builder.CreateSDiv(llvm::ConstantInt::get(it, 65536), v)};
+   builder.CreateRet(builder.CreateCall(types.callback, callback, args));
+   return m;
 }
 
-// A weak but fast PRNG is good enough for this. Use xorshift.
-// We seed it with the thread id to get deterministic behavior
-struct Random {
-   uint64_t state;
-   Random(uint64_t seed) : state((seed << 1) | 1) {}
+void* JITContainer::getSymbol(const char* name) const {
+   return jit->dlsym(name);
+}
 
-   uint64_t operator()() {
-      uint64_t x = state;
-      x ^= x >> 12;
-      x ^= x << 25;
-      x ^= x >> 27;
-      state = x;
-      return x * 0x2545F4914F6CDD1DULL;
+void JITContainer::configureTarget(llvm::EngineBuilder& builder) {
+   llvm::TargetOptions options;
+   options.EnableFastISel = config.fastISel;
+   options.EnableGlobalISel = config.globalISel;
+   options.GlobalISelAbort = llvm::GlobalISelAbortMode::Disable;
+   builder.setTargetOptions(options);
+   builder.setOptLevel(config.optLevel);
+   if (config.cpu == "native") {
+      builder.setMCPU(llvm::sys::getHostCPUName());
+      llvm::StringMap<bool> hostFeatures;
+      std::vector<std::string> features;
+      if (llvm::sys::getHostCPUFeatures(hostFeatures))
+         for (auto& f : hostFeatures) features.push_back((f.second ? "+" : "-") + f.first().str());
+      features.insert(features.end(), config.features.begin(), config.features.end());
+      builder.setMAttrs(features);
+   } else {
+      if (!config.cpu.empty()) builder.setMCPU(config.cpu);
+      builder.setMAttrs(config.features);
    }
-};
+}
 
-// One run with a certain error rate
-static unsigned doTest(unsigned errorRate, unsigned seed) {
-   Random random(seed);
+void JITContainer::setCodegenOption(const char* name, const char* value) {
+   auto option = llvm::cl::getRegisteredOptions()[name];
+   if (!option) return;
+   option->reset();
+   if (value) {
+      option->addOccurrence(0, name, value);
+      codegenOptions[name] = value;
+   } else {
+      codegenOptions.erase(name);
+   }
+}
 
-   // Execute the function n times and measure the runtime
-   auto start = std::chrono::steady_clock::now();
-   constexpr unsigned functionRepeat = 10;
-   constexpr unsigned repeat = 10000;
-   unsigned result = 0;
-   for (unsigned pass = 0; pass != functionRepeat; ++pass) {
-      // We frequently generate new JIT code to put pressure on the JIT registration mechanism
-      JITContainer jitCode;
+std::string JITContainer::describeSettings() {
+   std::string result = "cpu=" + config.cpu + " features=";
+   for (auto& f : config.features) result += f + ",";
+   result += " O" + std::to_string(static_cast<int>(config.optLevel)) + " fast-isel=" + std::to_string(config.fastISel) + " global-isel=" + std::to_string(config.globalISel);
+   for (auto& o : codegenOptions) result += " " + o.first + "=" + o.second;
+   return result;
+}
 
-      // Invoke the generated code repeatedly
-      for (unsigned index = 0; index != repeat; ++index) {
-         // Cause a failure with a certain probability
-         auto r = random();
-         int arg = ((r % 1000) < errorRate) ? -1 : ((r & 0xFFFF) + 1);
-         int expected = (arg < 1) ? -1 : ((arg & 1) ? (3 * arg + 1) : (arg / 2));
+void JITContainer::setFastRegisterAllocator(bool fast) {
+   using RegAllocOption = llvm::cl::opt<llvm::RegisterRegAlloc::FunctionPassCtor, false, llvm::RegisterPassParser<llvm::RegisterRegAlloc>>;
+   auto option = static_cast<RegAllocOption*>(llvm::cl::getRegisteredOptions()["regalloc"]);
+   if (!option) return;
+   setCodegenOption("regalloc", fast ? "fast" : nullptr);
+   // The fast allocator does not work within the optimizing register allocation pipeline, use the pipeline of O0
+   setCodegenOption("optimize-regalloc", fast ? "false" : nullptr);
+   // The first compilation latches the option as the default of the registry, thus later changes must update it
+   llvm::RegisterRegAlloc::setDefault(option->getValue());
+}
 
-         // Call the function itself
-         result += doTest(jitCode, arg, expected);
-      }
+JITContainer::JITContainer() {
+   auto context = ContextPool::get();
+   std::unique_ptr<llvm::Module> m;
+   {
+      auto lock = ContextPool::lock(context);
+      m = generateModule(*context.getContext());
    }
-   if (!result)
-      std::cerr << "invalid result!" << std::endl;
-   auto stop = std::chrono::steady_clock::now();
+   compile(std::move(context), move(m), nullptr);
+}
 
-   return std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
-};
+JITContainer::JITContainer(std::unique_ptr<llvm::LLVMContext>&& context, std::unique_ptr<llvm::Module>&& module, const char* entry, bool useObjectCache) {
+   compile(llvm::orc::ThreadSafeContext(move(context)), move(module), nullptr, entry, useObjectCache);
+}
 
-// Perform the test using n threads
-static unsigned doTestMultithreaded(unsigned errorRate, unsigned threadCount) {
-   if (threadCount <= 1) return doTest(errorRate, 0);
+JITContainer::JITContainer(std::unique_ptr<llvm::MemoryBuffer>&& object) {
+   compile(llvm::orc::ThreadSafeContext(), nullptr, move(object));
+}
 
-   std::vector<std::thread> threads;
-   std::atomic<unsigned> maxDuration{0};
-   threads.reserve(threadCount);
-   for (unsigned index = 0; index != threadCount; ++index) {
-      threads.push_back(std::thread([index, errorRate, &maxDuration]() {
-         unsigned duration = doTest(errorRate, index);
-         unsigned current = maxDuration.load();
-         while ((duration > current) && (!maxDuration.compare_exchange_weak(current, duration))) {}
-      }));
+// Aggregates the time spent in the individual passes when compiling JIT code, across all containers and threads. We use
+// the time trace profiler of LLVM, which supports multiple threads, and collect its events after every compilation
+class PassTimings {
+   struct Stage {
+      uint64_t totalUs = 0, count = 0;
    };
-   for (auto& t : threads) t.join();
-   return maxDuration.load();
-}
+   static std::mutex mutex;
+   // The stages per optimization level
+   static std::map<int, std::map<std::string, Stage>> stages;
 
-// Test with different thread counts
-static void runTests(const std::vector<unsigned>& threadCounts) {
-   const unsigned failureRates[] = {0, 1, 10, 100};
+   public:
+   // Start recording in the current thread
+   static void start() { llvm::timeTraceProfilerInitialize(0, "unwindingtest"); }
+   // Stop recording and aggregate the recorded passes
+   static void stop(int optLevel);
+   // Print the most expensive stages per optimization level
+   static void report(unsigned top);
+};
 
-   std::cout << "testing  using";
-   for (auto c : threadCounts) std::cout << " " << c;
-   std::cout << " threads" << std::endl;
-   for (unsigned fr : failureRates) {
-      std::cout << "failure rate " << (static_cast<double>(fr) / 10.0) << "%:";
-      for (auto tc : threadCounts)
-         std::cout << " " << doTestMultithreaded(fr, tc);
-      std::cout << std::endl;
-   }
-}
+std::mutex PassTimings::mutex;
+std::map<int, std::map<std::string, PassTimings::Stage>> PassTimings::stages;
 
-static std::vector<unsigned> buildThreadCounts(unsigned maxCount) {
-   std::vector<unsigned> threadCounts{1};
-   while (threadCounts.back() < maxCount) threadCounts.push_back(std::min(threadCounts.back() * 2, maxCount));
-   return threadCounts;
-}
+void PassTimings::stop(int optLevel) {
+   llvm::SmallString<0> buffer;
+   {
+      llvm::raw_svector_ostream out(buffer);
+      llvm::timeTraceProfilerWrite(out);
+   }
+   llvm::timeTraceProfilerCleanup();
+   auto trace = llvm::json::parse(buffer);
+   if (!trace) {
+      llvm::consumeError(trace.takeError());
+      return;
+   }
+   auto events = trace->getAsObject() ? trace->getAsObject()->getArray("traceEvents") : nullptr;
+   if (!events) return;
 
-static std::vector<unsigned> interpretThreadCounts(std::string desc) {
-   std::vector<unsigned> threadCounts;
-   auto add = [&](const std::string& desc) {
-      unsigned c = std::stoi(desc);
-      if (c) threadCounts.push_back(c);
-   };
-   while (desc.find(' ') != std::string::npos) {
-      auto split = desc.find(' ');
-      add(desc.substr(0, split));
-      desc = desc.substr(split + 1);
+   // Every pass is recorded as RunPass event, with nested passes being reported separately
+   std::unique_lock<std::mutex> lock(mutex);
+   auto& levelStages = stages[optLevel];
+   for (auto& e : *events) {
+      auto event = e.getAsObject();
+      if ((!event) || (event->getString("name") != llvm::StringRef("RunPass"))) continue;
+      auto args = event->getObject("args");
+      auto detail = args ? args->getString("detail") : llvm::None;
+      auto duration = event->getInteger("dur");
+      if ((!detail) || (!duration)) continue;
+      auto& stage = levelStages[detail->str()];
+      stage.totalUs += *duration;
+      ++stage.count;
    }
-   add(desc);
-   return threadCounts;
 }
 
-int main(int argc, char* argv[]) {
-   // Handle arguments
-   std::vector<unsigned> threadCounts = buildThreadCounts(std::thread::hardware_concurrency() / 2); // assuming half are hyperthreads. We can override that below
-   for (int index = 1; index < argc; ++index) {
-      std::string o = argv[index];
-      if ((o == "--threads") && (index + 1 < argc)) {
-         threadCounts = interpretThreadCounts(argv[++index]);
-      } else {
-         std::cout << "unknown option " << o << std::endl;
-         return 1;
+void PassTimings::report(unsigned top) {
+   std::unique_lock<std::mutex> lock(mutex);
+   for (auto& level : stages) {
+      uint64_t total = 0;
+      std::vector<std::pair<std::string, Stage>> sorted(level.second.begin(), level.second.end());
+      for (auto& s : sorted) total += s.second.totalUs;
+      std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) { return a.second.totalUs > b.second.totalUs; });
+      std::cout << "pass timings for O" << level.first << ", " << (total / 1000.0) << "ms total" << std::endl;
+      for (unsigned index = 0; (index != top) && (index < sorted.size()); ++index) {
+         auto& s = sorted[index];
+         std::cout << "  " << (s.second.totalUs / 1000.0) << "ms " << (total ? (100.0 * s.second.totalUs / total) : 0) << "% " << s.second.count << "x " << s.first << std::endl;
       }
    }
+}
 
-   // Init llvm
-   llvm::InitializeNativeTarget();
-   llvm::InitializeNativeTargetAsmPrinter();
+void JITContainer::compile(llvm::orc::ThreadSafeContext context, std::unique_ptr<llvm::Module>&& module, std::unique_ptr<llvm::MemoryBuffer>&& object, const char* entry, bool useObjectCache) {
+   // Compile into machine code, or only link if we got an object
+   auto start = std::chrono::steady_clock::now();
+   llvm::EngineBuilder engineBuilder;
+   configureTarget(engineBuilder);
+   jit = std::make_unique<JIT>(std::move(context), engineBuilder, useObjectCache ? config.objectCache : nullptr);
+   bool timePasses = config.timePasses && module;
+   if (module)
+      jit->add(move(module));
+   else
+      jit->add(move(object));
+   auto setup = std::chrono::steady_clock::now();
+   if (timePasses) PassTimings::start();
+   jitedCode = reinterpret_cast<Signature>(jit->dlsym(entry));
+   if (timePasses) PassTimings::stop(config.optLevel);
+   auto stop = std::chrono::steady_clock::now();
+   if (config.accountSizes && jit->memoryManager) CodeSizes::record(jit->sections, jit->memoryManager->allocatedSize, jit->memoryManager->getReservedSize());
+   timings.setupNs = std::chrono::duration_cast<std::chrono::nanoseconds>(setup - start).count();
+   timings.materializeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - setup).count();
+   timings.registerNs = jit->memoryManager ? jit->memoryManager->registerNs : 0;
+}
 
-   // Sanity tests
-   JITContainer container;
-   sanityTest(container);
+JITContainer::~JITContainer() {
+}
 
-   // Multi-rhreaded tests
-   runTests(threadCounts);
+size_t JITContainer::getAllocatedSize() const {
+   return jit->memoryManager ? jit->memoryManager->allocatedSize : 0;
+}
+
+size_t JITContainer::getReservedSize() const {
+   return jit->memoryManager ? jit->memoryManager->getReservedSize() : 0;
+}
+
+const std::vector<uint8_t*>& JITContainer::getEHFrames() const {
+   static const std::vector<uint8_t*> none;
+   return jit->memoryManager ? jit->memoryManager->ehFrames : none;
+}
+
+bool JITContainer::containsCode(const void* address) const {
+   if (!jit->memoryManager) return false;
+   auto a = static_cast<const uint8_t*>(address);
+   for (auto& section : jit->memoryManager->codeSections)
+      if ((a >= section.first) && (a < section.first + section.second)) return true;
+   return false;
+}
+
+// A cache for compiled JIT code, keyed by a fingerprint of the IR. If the memory reserved for code and unwind info
+// exceeds the budget, the least recently used entries are evicted. Evicted code remains valid until the last user releases it
+class JITCodeCache {
+   public:
+   struct Statistics {
+      uint64_t hits = 0, misses = 0, evictions = 0;
+      size_t entries = 0, usedBytes = 0;
+   };
+
+   private:
+   struct Entry {
+      uint64_t fingerprint;
+      std::shared_ptr<const JITContainer> container;
+      size_t size;
+   };
+
+   std::mutex mutex;
+   // The entries, most recently used first
+   std::list<Entry> lru;
+   std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+   size_t budget;
+   Statistics stats;
+
+   public:
+   explicit JITCodeCache(size_t budget) : budget(budget) {}
+
+   // Get the code for a module, compiling it if needed
+   std::shared_ptr<const JITContainer> get(std::unique_ptr<llvm::LLVMContext>&& context, std::unique_ptr<llvm::Module>&& module);
+   // Get the statistics
+   Statistics getStatistics() {
+      std::unique_lock<std::mutex> lock(mutex);
+      return stats;
+   }
+
+   // Compute the fingerprint of a module
+   static uint64_t fingerprint(const llvm::Module& module);
+};
+
+uint64_t JITCodeCache::fingerprint(const llvm::Module& module) {
+   std::string ir;
+   llvm::raw_string_ostream out(ir);
+   module.print(out, nullptr);
+   // The target and code generation settings influence the generated code, too
+   out << JITContainer::describeSettings();
+   return llvm::xxHash64(out.str());
+}
+
+std::shared_ptr<const JITContainer> JITCodeCache::get(std::unique_ptr<llvm::LLVMContext>&& context, std::unique_ptr<llvm::Module>&& module) {
+   uint64_t key = fingerprint(*module);
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      auto iter = entries.find(key);
+      if (iter != entries.end()) {
+         ++stats.hits;
+         lru.splice(lru.begin(), lru, iter->second);
+         return iter->second->container;
+      }
+      ++stats.misses;
+   }
+
+   // Compile without holding the lock. If another thread compiled the same code in the meantime we use that
+   auto container = std::make_shared<const JITContainer>(move(context), move(module));
+   size_t size = container->getReservedSize();
+   // Evicted code is released after unlocking, as destroying a container deregisters its unwind info. Declared before
+   // the lock to be destroyed after it
+   std::vector<std::shared_ptr<const JITContainer>> evicted;
+   std::unique_lock<std::mutex> lock(mutex);
+   auto iter = entries.find(key);
+   if (iter != entries.end()) return iter->second->container;
+   lru.push_front(Entry{key, container, size});
+   entries[key] = lru.begin();
+   stats.usedBytes += size;
+   while ((stats.usedBytes > budget) && (lru.size() > 1)) {
+      auto& victim = lru.back();
+      stats.usedBytes -= victim.size;
+      ++stats.evictions;
+      entries.erase(victim.fingerprint);
+      evicted.push_back(std::move(victim.container));
+      lru.pop_back();
+   }
+   stats.entries = lru.size();
+   return container;
+}
+
+// Deferred reclamation of JIT code. Handles keep code alive, but instead of updating a shared atomic counter they
+// count copies in non-atomic per-thread counters. These are published in batches whenever a thread passes a quiescent
+// state. A published count of zero does not mean that the code is unused, as another thread may hold a copy whose
+// increment is still pending. Thus collect() records the epoch in which it first saw the count at zero, and frees the
+// code only if the count stayed zero while every registered thread passed a quiescent state since then. Every update
+// of a shared count resets the zero epoch before it changes the count, thus a zero epoch only survives a span in which
+// no count change was published. Seeing the count at zero at two collections is not enough, as handles may have been
+// handed over and released in between. Unregistered threads update the shared counts directly
+class CodeCollector {
+   private:
+   struct Object {
+      std::unique_ptr<const JITContainer> container;
+      std::atomic<int64_t> count{0};
+      // The epoch in which the count was first seen at zero, 0 if it was not zero at the last collection or if a count
+      // change was published since
+      std::atomic<uint64_t> zeroEpoch{0};
+   };
+   struct ThreadState {
+      // A small direct-mapped table of pending count changes
+      static constexpr unsigned slotCount = 64;
+      struct Slot {
+         Object* object = nullptr;
+         int64_t delta = 0;
+      } slots[slotCount];
+      // The last epoch in which the thread published its counts
+      std::atomic<uint64_t> publishedEpoch{0};
+   };
+
+   static std::mutex mutex;
+   static std::vector<ThreadState*> threads;
+   static std::vector<Object*> objects;
+   static std::atomic<uint64_t> epoch;
+   static thread_local ThreadState* local;
+
+   // Publish a count change. Resetting the zero epoch first guarantees that a collection that sees the changed count
+   // also sees the reset
+   static void publish(Object* object, int64_t delta) {
+      object->zeroEpoch.store(0);
+      object->count.fetch_add(delta);
+   }
+   // Change the count of an object
+   static void adjust(Object* object, int64_t delta) {
+      auto state = local;
+      if (!state) {
+         publish(object, delta);
+         return;
+      }
+      auto& slot = state->slots[(reinterpret_cast<uintptr_t>(object) >> 4) % ThreadState::slotCount];
+      if (slot.object != object) {
+         if (slot.delta) publish(slot.object, slot.delta);
+         slot.object = object;
+         slot.delta = 0;
+      }
+      slot.delta += delta;
+   }
+
+   public:
+   // A copyable reference to JIT code
+   class Handle {
+      Object* object = nullptr;
+      friend class CodeCollector;
+
+      explicit Handle(Object* object) : object(object) { adjust(object, 1); }
+
+      public:
+      Handle() = default;
+      Handle(const Handle& other) : object(other.object) {
+         if (object) adjust(object, 1);
+      }
+      Handle(Handle&& other) noexcept : object(other.object) { other.object = nullptr; }
+      ~Handle() {
+         if (object) adjust(object, -1);
+      }
+      Handle& operator=(Handle other) {
+         std::swap(object, other.object);
+         return *this;
+      }
+
+      const JITContainer& operator*() const { return *object->container; }
+      explicit operator bool() const { return object; }
+   };
+
+   // Registers the current thread for the lifetime of the scope
+   class ThreadScope {
+      ThreadState state;
+
+      public:
+      ThreadScope();
+      ~ThreadScope();
+   };
+
+   // Take ownership of JIT code
+   static Handle add(std::unique_ptr<const JITContainer>&& container);
+   // Publish the counts of the current thread
+   static void quiescentState();
+   // Free all unreferenced code. Code is freed by the second collection that finds it unreferenced at the earliest.
+   // Returns the number of freed containers
+   static unsigned collect();
+};
+
+std::mutex CodeCollector::mutex;
+std::vector<CodeCollector::ThreadState*> CodeCollector::threads;
+std::vector<CodeCollector::Object*> CodeCollector::objects;
+std::atomic<uint64_t> CodeCollector::epoch{1};
+thread_local CodeCollector::ThreadState* CodeCollector::local = nullptr;
+
+CodeCollector::ThreadScope::ThreadScope() {
+   state.publishedEpoch = epoch.load();
+   local = &state;
+   std::unique_lock<std::mutex> lock(mutex);
+   threads.push_back(&state);
+}
+
+CodeCollector::ThreadScope::~ThreadScope() {
+   quiescentState();
+   local = nullptr;
+   std::unique_lock<std::mutex> lock(mutex);
+   threads.erase(std::find(threads.begin(), threads.end(), &state));
+}
+
+CodeCollector::Handle CodeCollector::add(std::unique_ptr<const JITContainer>&& container) {
+   auto object = new Object;
+   object->container = move(container);
+   std::unique_lock<std::mutex> lock(mutex);
+   objects.push_back(object);
+   return Handle(object);
+}
+
+void CodeCollector::quiescentState() {
+   auto state = local;
+   if (!state) return;
+   for (auto& slot : state->slots) {
+      if (slot.delta) publish(slot.object, slot.delta);
+      slot = ThreadState::Slot();
+   }
+   state->publishedEpoch.store(epoch.load());
+}
+
+unsigned CodeCollector::collect() {
+   std::vector<Object*> garbage;
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      uint64_t current = epoch.fetch_add(1) + 1, minEpoch = current;
+      for (auto t : threads) minEpoch = std::min(minEpoch, t->publishedEpoch.load());
+      auto keep = std::partition(objects.begin(), objects.end(), [&](Object* o) {
+         if (o->count.load() != 0) {
+            o->zeroEpoch = 0;
+            return true;
+         }
+         // Start a zero span, unless a concurrent count change reset it in the meantime
+         uint64_t zeroEpoch = o->zeroEpoch.load();
+         if (!zeroEpoch) {
+            o->zeroEpoch.compare_exchange_strong(zeroEpoch, current);
+            return true;
+         }
+         // The count stayed zero since then, and pending changes from before have been published since
+         return zeroEpoch >= minEpoch;
+      });
+      garbage.assign(keep, objects.end());
+      objects.erase(keep, objects.end());
+   }
+   // Free the code outside the lock
+   for (auto o : garbage) delete o;
+   return garbage.size();
+}
+
+// An object cache in shared memory that can be used by multiple processes. Compiled objects are keyed by the
+// fingerprint of their IR. Slots are claimed with a CAS on the key and become visible when their size is published,
+// objects are appended to a data area until it is full. Entries are never removed
+class SharedObjectCache : public llvm::ObjectCache {
+   public:
+   struct Statistics {
+      std::atomic<uint64_t> hits, misses, published, rejected;
+   };
+
+   private:
+   static constexpr unsigned slotCount = 4096;
+   struct Slot {
+      // The fingerprint, 0 if unused
+      std::atomic<uint64_t> key;
+      // The size of the object, set once the object is published. ~0 if the object did not fit
+      std::atomic<uint64_t> size;
+      uint64_t offset;
+   };
+   struct Header {
+      std::atomic<uint64_t> size;
+      std::atomic<uint64_t> used;
+      Statistics stats;
+      Slot slots[slotCount];
+   };
+   static constexpr uint64_t rejected = ~0ull;
+
+   Header* header = nullptr;
+   char* data = nullptr;
+   size_t size = 0, capacity = 0;
+
+   static uint64_t keyOf(const llvm::Module& module);
+
+   public:
+   // Create a cache of the given size. Without a name the cache is anonymous and shared with forked processes,
+   // otherwise it is attached to the POSIX shared memory object of that name
+   explicit SharedObjectCache(size_t size, const std::string& name = "");
+   ~SharedObjectCache();
+   // Remove the shared memory object of a named cache. Processes that are attached keep using it
+   static void remove(const std::string& name) { shm_unlink(name.c_str()); }
+
+   bool isValid() const { return header; }
+   const Statistics& getStatistics() const { return header->stats; }
+
+   void notifyObjectCompiled(const llvm::Module* module, llvm::MemoryBufferRef object) override;
+   std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* module) override;
+};
+
+SharedObjectCache::SharedObjectCache(size_t size, const std::string& name) : size(size) {
+   int fd = name.empty() ? memfd_create("jitcache", 0) : shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+   if (fd < 0) return;
+   struct stat st;
+   if ((fstat(fd, &st) != 0) || ((static_cast<size_t>(st.st_size) < size) && (ftruncate(fd, size) != 0)) || (size < sizeof(Header))) {
+      close(fd);
+      return;
+   }
+   void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (mapping == MAP_FAILED) return;
+
+   // Fresh shared memory is zero, which is a valid empty cache. We only have to check that all users agree on the size
+   auto h = static_cast<Header*>(mapping);
+   uint64_t expected = 0;
+   if ((!h->size.compare_exchange_strong(expected, size)) && (expected != size)) {
+      munmap(mapping, size);
+      return;
+   }
+   header = h;
+   data = static_cast<char*>(mapping) + sizeof(Header);
+   capacity = size - sizeof(Header);
+}
+
+SharedObjectCache::~SharedObjectCache() {
+   if (header) munmap(header, size);
+}
+
+uint64_t SharedObjectCache::keyOf(const llvm::Module& module) {
+   return std::max<uint64_t>(JITCodeCache::fingerprint(module), 1);
+}
+
+void SharedObjectCache::notifyObjectCompiled(const llvm::Module* module, llvm::MemoryBufferRef object) {
+   uint64_t key = keyOf(*module);
+   for (unsigned probe = 0; probe != slotCount; ++probe) {
+      auto& slot = header->slots[(key + probe) % slotCount];
+      uint64_t current = 0;
+      if (!slot.key.compare_exchange_strong(current, key)) {
+         // Somebody else is already publishing that object, or the slot is used by another one
+         if (current == key) return;
+         continue;
+      }
+
+      // Reserve space and publish the object
+      uint64_t objectSize = object.getBufferSize();
+      uint64_t offset = header->used.fetch_add(objectSize);
+      if (offset + objectSize > capacity) {
+         slot.size.store(rejected, std::memory_order_release);
+         ++header->stats.rejected;
+         return;
+      }
+      memcpy(data + offset, object.getBufferStart(), objectSize);
+      slot.offset = offset;
+      slot.size.store(objectSize, std::memory_order_release);
+      ++header->stats.published;
+      return;
+   }
+   ++header->stats.rejected;
+}
+
+std::unique_ptr<llvm::MemoryBuffer> SharedObjectCache::getObject(const llvm::Module* module) {
+   uint64_t key = keyOf(*module);
+   for (unsigned probe = 0; probe != slotCount; ++probe) {
+      auto& slot = header->slots[(key + probe) % slotCount];
+      uint64_t current = slot.key.load();
+      if (!current) break;
+      if (current != key) continue;
+      uint64_t objectSize = slot.size.load(std::memory_order_acquire);
+      if ((!objectSize) || (objectSize == rejected)) break;
+      ++header->stats.hits;
+      return llvm::MemoryBuffer::getMemBuffer(llvm::StringRef(data + slot.offset, objectSize), "", false);
+   }
+   ++header->stats.misses;
+   return nullptr;
+}
+
+// An object cache on disk. Later runs can load the compiled objects instead of compiling them
+class DiskObjectCache : public llvm::ObjectCache {
+   std::string directory;
+
+   std::string pathOf(const llvm::Module& module) const { return directory + "/" + llvm::utohexstr(JITCodeCache::fingerprint(module)) + ".o"; }
+
+   public:
+   explicit DiskObjectCache(std::string directory) : directory(std::move(directory)) {}
+
+   void notifyObjectCompiled(const llvm::Module* module, llvm::MemoryBufferRef object) override {
+      // Write to a temporary file first to never expose partial objects
+      auto path = pathOf(*module), tmp = path + "." + std::to_string(getpid());
+      {
+         std::ofstream out(tmp, std::ios::binary);
+         out.write(object.getBufferStart(), object.getBufferSize());
+         if (!out) return;
+      }
+      rename(tmp.c_str(), path.c_str());
+   }
+   std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* module) override {
+      auto buffer = llvm::MemoryBuffer::getFile(pathOf(*module));
+      return buffer ? std::move(*buffer) : nullptr;
+   }
+};
+
+// Serves calls from JIT code that was linked from a prebuilt object until the code compiled from IR is available.
+// Calls must only be made once one of them was published
+class TieredFunction {
+   std::atomic<const JITContainer*> jitCode{nullptr};
+   std::atomic<bool> compiled{false};
+
+   public:
+   void publishLinked(const JITContainer* code) { jitCode.store(code, std::memory_order_release); }
+   void publishCompiled(const JITContainer* code) {
+      jitCode.store(code, std::memory_order_release);
+      compiled.store(true, std::memory_order_release);
+   }
+   bool isCompiled() const { return compiled.load(std::memory_order_acquire); }
+
+   int invoke(int (*callback)(int), int v) const { return jitCode.load(std::memory_order_acquire)->invoke(callback, v); }
+};
+
+// A weak but fast PRNG is good enough for this. Use xorshift.
+// We seed it with the thread id to get deterministic behavior
+struct Random {
+   uint64_t state;
+   Random(uint64_t seed) : state((seed << 1) | 1) {}
+
+   uint64_t operator()() {
+      uint64_t x = state;
+      x ^= x >> 12;
+      x ^= x << 25;
+      x ^= x >> 27;
+      state = x;
+      return x * 0x2545F4914F6CDD1DULL;
+   }
+};
+
+// The number of Collatz steps that the callback performs per call
+static unsigned workIterations = 1;
+// The number of bytes that the callback touches per call
+static size_t workingSetSize = 0;
+// The expected callback results for all arguments that we use. They are computed before the tests, to keep the
+// oracle out of the timed calls
+static std::vector<int> expectedResults;
+static constexpr int maxArgument = 0x10000;
+
+// Perform a number of Collatz steps
+static int collatz(int v, unsigned iterations) {
+   unsigned x = v;
+   for (unsigned index = 0; index != iterations; ++index) x = (x & 1) ? (3 * x + 1) : (x / 2);
+   return x;
+}
+
+// Compute the result of collatz without performing all steps. Once the sequence reaches 1 it cycles through 1, 4, 2,
+// which all arguments up to maxArgument do within a few hundred steps
+static int collatzShortcut(int v, unsigned iterations) {
+   unsigned x = v, index = 0;
+   for (; (index != iterations) && (x != 1); ++index) x = (x & 1) ? (3 * x + 1) : (x / 2);
+   if (x != 1) return x;
+   const unsigned cycle[3] = {1, 4, 2};
+   return cycle[(iterations - index) % 3];
+}
+
+// Touch the working set of the current thread, one access per cache line
+static void touchWorkingSet() {
+   static thread_local std::vector<unsigned char> workingSet;
+   static thread_local unsigned char sink;
+   if (workingSet.size() != workingSetSize) workingSet.assign(workingSetSize, 1);
+   unsigned char sum = 0;
+   for (size_t index = 0; index < workingSetSize; index += 64) sum += workingSet[index]++;
+   sink += sum;
+}
+
+// The callback function that we use. Throws on input<1
+static int callback(int v) {
+   if (v < 1) throw v;
+   if (workingSetSize) touchWorkingSet();
+   return collatz(v, workIterations);
+}
+
+// The container whose code calls backtraceCallback on this thread
+static thread_local const JITContainer* backtraceContainer = nullptr;
+
+// A callback that captures a backtrace through the generated code before doing the work of callback. The backtrace
+// must contain a return address inside the code of backtraceContainer
+static int backtraceCallback(int v) {
+   void* frames[64];
+   int depth = backtrace(frames, 64);
+   bool found = false;
+   for (int index = 1; (index < depth) && (!found); ++index) found = backtraceContainer->containsCode(frames[index]);
+   if (!found) {
+      std::cerr << "backtrace through JIT code failed" << std::endl;
+      exit(1);
+   }
+   return callback(v);
+}
+
+// The result that we expect from the callback, -1 if it throws
+static int expectedResult(int v) {
+   if (v < 1) return -1;
+   if (v > maxArgument) return collatz(v, workIterations);
+   return expectedResults[v];
+}
+
+// Configure the work per call, and precompute the expected results to not double the work during tests
+static void setWork(unsigned iterations, size_t bytes) {
+   workIterations = std::max(iterations, 1u);
+   workingSetSize = bytes;
+   expectedResults.resize(maxArgument + 1);
+   for (int v = 1; v <= maxArgument; ++v) expectedResults[v] = collatzShortcut(v, workIterations);
+}
+
+// Measure the time of a callback that performs the given number of Collatz steps on an argument of the tests. Small
+// numbers of steps are dominated by the unpredictable start of the sequences, large ones by the cheaper 4-2-1 cycle,
+// thus we time complete calls over a window that is long enough to be stable. The callback is called through a pointer
+// like the generated code does, to time the same code as the tests
+static double timeCallback(unsigned iterations) {
+   constexpr double windowNs = 20000000;
+   // Read the clock only every few calls, its cost would distort short calls
+   unsigned batch = std::max(10000u / iterations, 1u);
+   int (*volatile call)(int) = callback;
+   // Time the computation alone, the working set is configured separately
+   unsigned configuredIterations = workIterations;
+   size_t configuredWorkingSet = workingSetSize;
+   workIterations = iterations;
+   workingSetSize = 0;
+   volatile int sink = 0;
+   Random random(iterations);
+   uint64_t calls = 0;
+   double elapsed;
+   auto start = std::chrono::steady_clock::now();
+   do {
+      for (unsigned index = 0; index != batch; ++index) sink = sink + call((random() & 0xFFFF) + 1);
+      calls += batch;
+      elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+   } while (elapsed < windowNs);
+   workIterations = configuredIterations;
+   workingSetSize = configuredWorkingSet;
+   return elapsed / calls;
+}
+
+// Find the number of Collatz steps per call that takes approximately the given time. The cost per step depends on the
+// number of steps, thus we search for it instead of extrapolating from a single probe
+static unsigned calibrateWork(double targetNs) {
+   // Double the steps until a call takes at least the target time, then bisect to within 2%
+   unsigned low = 0, high = 1;
+   while ((timeCallback(high) < targetNs) && (high < (1u << 30))) {
+      low = high;
+      high *= 2;
+   }
+   while (high - low > std::max(high / 64, 1u)) {
+      unsigned middle = low + (high - low) / 2;
+      if (timeCallback(middle) < targetNs)
+         low = middle;
+      else
+         high = middle;
+   }
+   return std::max(high, 1u);
+}
+
+// A helper function for tests. Checks that we get the expected output
+template <class Code>
+static bool doTest(const Code& jitCode, int input, int expected) {
+   try {
+      Watchdog::Scope scope((expected < 0) ? Watchdog::Throw : Watchdog::Idle);
+      int r = jitCode.invoke(callback, input);
+      if ((r < 0) || (r != expected)) {
+         std::cerr << "unexpected result for input " << input << ", expected " << expected << ", got " << r << std::endl;
+         exit(1);
+      }
+   } catch (int) {
+      if (expected >= 0) {
+         std::cerr << "unexpected result for input " << input << ", expected " << expected << ", got exception" << std::endl;
+         exit(1);
+      }
+   }
+   return true;
+}
+
+// Sanity test to check the generated code works as intended
+template <class Code>
+static void sanityTest(const Code& jitCode) {
+   doTest(jitCode, 2, expectedResult(2));
+   doTest(jitCode, 1, expectedResult(1));
+   doTest(jitCode, 0, -1);
+   doTest(jitCode, -1, -1);
+}
+
+// The number of live containers per thread, and if we pick randomly among them instead of round-robin
+static unsigned liveContainers = 1;
+static bool randomPick = false;
+
+// The precompiled object that the tests use instead of compiling code, if any
+static std::unique_ptr<llvm::MemoryBuffer> precompiledObject;
+
+// Create a container, either by compiling or by linking the precompiled object
+static std::unique_ptr<JITContainer> makeContainer() {
+   if (precompiledObject) return std::make_unique<JITContainer>(llvm::MemoryBuffer::getMemBuffer(precompiledObject->getMemBufferRef(), false));
+   return std::make_unique<JITContainer>();
+}
+
+// The nanoseconds between two points in time, by default until now
+static double elapsedNs(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now()) {
+   return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
+}
+// Convert nanoseconds for reporting
+static double us(double ns) { return ns / 1000.0; }
+static double ms(double ns) { return ns / 1000000.0; }
+
+// Collects latency samples in nanoseconds
+struct LatencyStats {
+   std::vector<uint64_t> samples;
+   bool sorted = true;
+
+   void add(uint64_t ns) {
+      samples.push_back(ns);
+      sorted = false;
+   }
+   void merge(const LatencyStats& other) {
+      samples.insert(samples.end(), other.samples.begin(), other.samples.end());
+      sorted = false;
+   }
+   uint64_t percentile(double p) {
+      if (samples.empty()) return 0;
+      if (!sorted) {
+         std::sort(samples.begin(), samples.end());
+         sorted = true;
+      }
+      return samples[std::min<size_t>(p * samples.size(), samples.size() - 1)];
+   }
+};
+
+// Optional measurements that are collected by doTest
+struct Measurements {
+   // The latency of calls that throw
+   LatencyStats throwLatency;
+   // The latency of creating the containers that replace the old ones
+   LatencyStats compileLatency;
+   // Every switchSampleInterval-th throw is sampled for context switches of the throwing thread instead of its latency,
+   // as querying the switch counters costs two system calls. The samples show if the throwing thread itself blocked
+   // (voluntary switch) or was preempted (involuntary switch), not whether the holder of the unwinder lock was
+   static constexpr unsigned switchSampleInterval = 16;
+   uint64_t switchSampledThrows = 0;
+   uint64_t throwsWithVoluntarySwitch = 0;
+   uint64_t throwsWithInvoluntarySwitch = 0;
+   // The context switches of the thread over the whole run
+   uint64_t voluntarySwitches = 0, involuntarySwitches = 0;
+
+   void merge(const Measurements& other) {
+      throwLatency.merge(other.throwLatency);
+      compileLatency.merge(other.compileLatency);
+      switchSampledThrows += other.switchSampledThrows;
+      throwsWithVoluntarySwitch += other.throwsWithVoluntarySwitch;
+      throwsWithInvoluntarySwitch += other.throwsWithInvoluntarySwitch;
+      voluntarySwitches += other.voluntarySwitches;
+      involuntarySwitches += other.involuntarySwitches;
+   }
+};
+
+// One run with a certain error rate. Returns the runtime in ms
+static double doTest(unsigned errorRate, unsigned seed, Measurements* measurements = nullptr) {
+   Random random(seed);
+
+   // Keep additional live containers if requested. One of them is replaced in every pass. The replacement index
+   // continues where the previous run stopped, so that with more containers than passes all of them get replaced
+   constexpr unsigned functionRepeat = 10;
+   static std::atomic<unsigned> nextReplacement{0};
+   unsigned firstReplacement = nextReplacement.fetch_add(functionRepeat) % liveContainers;
+   std::vector<std::unique_ptr<JITContainer>> containers(liveContainers);
+   for (unsigned index = 0; index < liveContainers; ++index)
+      if (index != firstReplacement) containers[index] = makeContainer();
+
+   // Execute the function n times and measure the runtime
+   rusage startUsage;
+   if (measurements) getrusage(RUSAGE_THREAD, &startUsage);
+   auto start = std::chrono::steady_clock::now();
+   constexpr unsigned repeat = 10000;
+   unsigned result = 0, throws = 0;
+   for (unsigned pass = 0; pass != functionRepeat; ++pass) {
+      // We frequently generate new JIT code to put pressure on the JIT registration mechanism
+      auto& slot = containers[(firstReplacement + pass) % liveContainers];
+      slot.reset();
+      auto compileStart = std::chrono::steady_clock::now();
+      slot = makeContainer();
+      if (measurements) measurements->compileLatency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - compileStart).count());
+
+      // Invoke the generated code repeatedly
+      for (unsigned index = 0; index != repeat; ++index) {
+         // Cause a failure with a certain probability
+         auto r = random();
+         int arg = ((r % 1000) < errorRate) ? -1 : ((r & 0xFFFF) + 1);
+         int expected = expectedResult(arg);
+
+         // Pick the container to use
+         const JITContainer& jitCode = *containers[randomPick ? ((r >> 32) % liveContainers) : (index % liveContainers)];
+
+         // Call the function itself, measuring the throw latency if requested
+         if (measurements && (expected < 0) && (++throws % Measurements::switchSampleInterval == 0)) {
+            rusage before, after;
+            getrusage(RUSAGE_THREAD, &before);
+            result += doTest(jitCode, arg, expected);
+            getrusage(RUSAGE_THREAD, &after);
+            ++measurements->switchSampledThrows;
+            measurements->throwsWithVoluntarySwitch += (after.ru_nvcsw != before.ru_nvcsw);
+            measurements->throwsWithInvoluntarySwitch += (after.ru_nivcsw != before.ru_nivcsw);
+         } else if (measurements && (expected < 0)) {
+            auto throwStart = std::chrono::steady_clock::now();
+            result += doTest(jitCode, arg, expected);
+            auto throwStop = std::chrono::steady_clock::now();
+            measurements->throwLatency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(throwStop - throwStart).count());
+         } else {
+            result += doTest(jitCode, arg, expected);
+         }
+      }
+   }
+   if (!result)
+      std::cerr << "invalid result!" << std::endl;
+   auto stop = std::chrono::steady_clock::now();
+   if (measurements) {
+      rusage stopUsage;
+      getrusage(RUSAGE_THREAD, &stopUsage);
+      measurements->voluntarySwitches += stopUsage.ru_nvcsw - startUsage.ru_nvcsw;
+      measurements->involuntarySwitches += stopUsage.ru_nivcsw - startUsage.ru_nivcsw;
+   }
+
+   return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count()) / 1000000.0;
+};
+
+// Perform the test using n threads
+static double doTestMultithreaded(unsigned errorRate, unsigned threadCount, Measurements* measurements = nullptr) {
+   if (threadCount <= 1) return doTest(errorRate, 0, measurements);
+
+   std::vector<std::thread> threads;
+   double maxDuration = 0;
+   std::mutex resultMutex;
+   threads.reserve(threadCount);
+   for (unsigned index = 0; index != threadCount; ++index) {
+      threads.push_back(std::thread([index, errorRate, measurements, &maxDuration, &resultMutex]() {
+         Measurements local;
+         double duration = doTest(errorRate, index, measurements ? &local : nullptr);
+         std::unique_lock<std::mutex> lock(resultMutex);
+         maxDuration = std::max(maxDuration, duration);
+         if (measurements) measurements->merge(local);
+      }));
+   };
+   for (auto& t : threads) t.join();
+   return maxDuration;
+}
+
+// The failure rates in 1/1000 that we test
+static std::vector<unsigned> failureRates = {0, 1, 10, 100};
+
+// The measurements of one cell of the result matrix
+struct Cell {
+   unsigned failureRate, threadCount;
+   // The duration of each trial in ms
+   std::vector<double> trials;
+   // The scenario that produced the cell, empty when running without a scenario file
+   std::string scenario;
+};
+
+// Robust statistics over the trials of a cell
+struct CellStatistics {
+   // The median and the median absolute deviation after outlier rejection
+   double median = 0, mad = 0;
+   // The bootstrap 95% confidence interval of the median
+   double ciLow = 0, ciHigh = 0;
+   // The number of rejected trials
+   unsigned outliers = 0;
+   // Is the variance too high to trust the median?
+   bool unstable = false;
+};
+
+static double median(std::vector<double> values) {
+   if (values.empty()) return 0;
+   std::sort(values.begin(), values.end());
+   size_t n = values.size();
+   return (n & 1) ? values[n / 2] : ((values[n / 2 - 1] + values[n / 2]) / 2);
+}
+
+static double medianAbsoluteDeviation(const std::vector<double>& values, double m) {
+   std::vector<double> deviations;
+   for (double v : values) deviations.push_back(std::abs(v - m));
+   return median(deviations);
+}
+
+// The number of trials below which no outliers are rejected. With fewer trials the MAD is too small to tell an outlier
+// from the spread, e.g., with 3 trials it is the smaller of the two deviations, which would reject the other one
+static constexpr unsigned minRejectionTrials = 5;
+
+// Compute the statistics of a cell. With enough trials, those that are more than 3 scaled MADs away from the median
+// are rejected
+static CellStatistics analyzeCell(const std::vector<double>& trials) {
+   CellStatistics result;
+   double m = median(trials), mad = medianAbsoluteDeviation(trials, m);
+   std::vector<double> kept;
+   for (double t : trials)
+      if ((trials.size() < minRejectionTrials) || (mad == 0) || (std::abs(t - m) <= 3 * 1.4826 * mad)) kept.push_back(t);
+   result.outliers = trials.size() - kept.size();
+   result.median = median(kept);
+   result.mad = medianAbsoluteDeviation(kept, result.median);
+
+   // Bootstrap the median
+   constexpr unsigned resamples = 1000;
+   Random random(kept.size());
+   std::vector<double> medians, sample(kept.size());
+   medians.reserve(resamples);
+   for (unsigned index = 0; index != resamples; ++index) {
+      for (auto& s : sample) s = kept[random() % kept.size()];
+      medians.push_back(median(sample));
+   }
+   std::sort(medians.begin(), medians.end());
+   result.ciLow = medians[resamples * 25 / 1000];
+   result.ciHigh = medians[resamples * 975 / 1000];
+
+   // We do not trust cells whose relative spread is above 10%
+   result.unstable = (result.mad > 0.1 * result.median) || ((result.ciHigh - result.ciLow) > 0.2 * result.median);
+   return result;
+}
+
+// Test with different thread counts. Every cell is measured trials times after warmup runs whose results are discarded
+static std::vector<Cell> runTests(const std::vector<unsigned>& threadCounts, unsigned trials = 1, unsigned warmup = 0) {
+   std::vector<Cell> cells;
+   std::cout << "testing  using";
+   for (auto c : threadCounts) std::cout << " " << c;
+   std::cout << " threads";
+   if (trials > 1) std::cout << ", reporting median±MAD[95% CI] of " << trials << " trials";
+   std::cout << std::endl;
+   bool anyUnstable = false, anyOutliers = false;
+   for (unsigned fr : failureRates) {
+      std::cout << "failure rate " << (static_cast<double>(fr) / 10.0) << "%:";
+      for (auto tc : threadCounts) {
+         Cell cell{fr, tc, {}, {}};
+         for (unsigned index = 0; index != warmup; ++index) doTestMultithreaded(fr, tc);
+         for (unsigned index = 0; index != std::max(trials, 1u); ++index) cell.trials.push_back(doTestMultithreaded(fr, tc));
+         if (trials > 1) {
+            auto stats = analyzeCell(cell.trials);
+            std::cout << " " << stats.median << "±" << stats.mad << "[" << stats.ciLow << "," << stats.ciHigh << "]";
+            if (stats.outliers) std::cout << "(-" << stats.outliers << ")";
+            if (stats.unstable) std::cout << "?";
+            anyUnstable |= stats.unstable;
+            anyOutliers |= stats.outliers;
+         } else {
+            std::cout << " " << cell.trials.front();
+         }
+         std::cout.flush();
+         cells.push_back(std::move(cell));
+      }
+      std::cout << std::endl;
+   }
+   if (anyOutliers) std::cout << "cells marked with (-n) had n trials rejected as outliers" << std::endl;
+   if (anyUnstable) std::cout << "cells marked with ? have too much variance to be trusted, even after rejecting outliers" << std::endl;
+   return cells;
+}
+
+// Store the results in a simple text format, one cell per line: failure rate, thread count, trials. The cells of a
+// scenario follow a [name] line
+static bool writeResults(const std::string& file, const std::vector<Cell>& cells) {
+   std::ofstream out(file);
+   // Keep the trial durations with microsecond precision
+   out << std::fixed;
+   out.precision(3);
+   out << "# unwindingtest results: failure rate (1/1000), thread count, trial durations (ms)" << std::endl;
+   std::string scenario;
+   for (auto& c : cells) {
+      if (c.scenario != scenario) {
+         scenario = c.scenario;
+         out << "[" << scenario << "]" << std::endl;
+      }
+      out << c.failureRate << " " << c.threadCount;
+      for (double t : c.trials) out << " " << t;
+      out << std::endl;
+   }
+   return static_cast<bool>(out);
+}
+
+static bool readResults(const std::string& file, std::vector<Cell>& cells) {
+   std::ifstream in(file);
+   if (!in) return false;
+   std::string line, scenario;
+   while (std::getline(in, line)) {
+      if (line.empty() || (line[0] == '#')) continue;
+      if ((line[0] == '[') && (line.back() == ']')) {
+         scenario = line.substr(1, line.size() - 2);
+         continue;
+      }
+      std::istringstream l(line);
+      Cell c{0, 0, {}, scenario};
+      if (!(l >> c.failureRate >> c.threadCount)) return false;
+      double t;
+      while (l >> t) c.trials.push_back(t);
+      if (c.trials.empty()) return false;
+      cells.push_back(std::move(c));
+   }
+   return true;
+}
+
+// One-sided Mann-Whitney U test that the values in b tend to be larger than in a. Returns the p-value using the normal
+// approximation with tie correction, or 1 if there are too few values to test
+static double mannWhitneyGreater(const std::vector<double>& a, const std::vector<double>& b) {
+   size_t n1 = a.size(), n2 = b.size(), n = n1 + n2;
+   if ((n1 < 3) || (n2 < 3)) return 1;
+
+   // Rank all values, using the average rank for ties
+   std::vector<std::pair<double, bool>> values;
+   for (double v : a) values.push_back({v, false});
+   for (double v : b) values.push_back({v, true});
+   std::sort(values.begin(), values.end(), [](auto& x, auto& y) { return x.first < y.first; });
+   double rankSumB = 0, tieCorrection = 0;
+   for (size_t from = 0; from < n;) {
+      size_t to = from;
+      while ((to < n) && (values[to].first == values[from].first)) ++to;
+      double rank = (from + to + 1) / 2.0, ties = to - from;
+      for (size_t index = from; index != to; ++index)
+         if (values[index].second) rankSumB += rank;
+      tieCorrection += ties * ties * ties - ties;
+      from = to;
+   }
+   double u = rankSumB - n2 * (n2 + 1) / 2.0;
+   double mean = n1 * n2 / 2.0;
+   double variance = n1 * n2 / 12.0 * ((n + 1) - tieCorrection / (n * (n - 1)));
+   if (variance <= 0) return (u > mean) ? 0 : 1;
+   double z = (u - mean - 0.5) / std::sqrt(variance);
+   return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+// The number of trials per cell that the comparison with a baseline needs to test a slowdown
+static constexpr unsigned minBaselineTrials = 3;
+
+// Compare the results with a baseline. A cell regresses if its median got slower by more than threshold percent, and
+// if the slowdown is significant. Slowdowns that cannot be tested due to too few trials are reported as inconclusive,
+// and cells without a baseline as missing. Returns false if any cell regressed, was inconclusive or missing
+static bool compareWithBaseline(const std::vector<Cell>& baseline, const std::vector<Cell>& cells, double threshold) {
+   constexpr double significance = 0.05;
+   bool regressed = false, inconclusive = false, missing = false;
+   std::cout << "comparison with baseline (threshold " << threshold << "%)" << std::endl;
+   std::cout << "scenario|failure rate|threads|baseline|current|change|p-value|status" << std::endl;
+   for (auto& c : cells) {
+      auto b = std::find_if(baseline.begin(), baseline.end(), [&](const Cell& b) { return (b.scenario == c.scenario) && (b.failureRate == c.failureRate) && (b.threadCount == c.threadCount); });
+      if (b == baseline.end()) {
+         std::cout << (c.scenario.empty() ? "-" : c.scenario) << "|" << (static_cast<double>(c.failureRate) / 10.0) << "%|" << c.threadCount << "|n/a|" << analyzeCell(c.trials).median << "|n/a|n/a|missing" << std::endl;
+         missing = true;
+         continue;
+      }
+      double before = analyzeCell(b->trials).median, after = analyzeCell(c.trials).median;
+      double change = (before > 0) ? (after / before - 1) * 100 : 0;
+      double p = mannWhitneyGreater(b->trials, c.trials);
+      bool testable = (b->trials.size() >= minBaselineTrials) && (c.trials.size() >= minBaselineTrials);
+      const char* status = "ok";
+      if ((change > threshold) && (!testable)) {
+         status = "inconclusive";
+         inconclusive = true;
+      } else if ((change > threshold) && (p < significance)) {
+         status = "REGRESSION";
+         regressed = true;
+      } else if (change < -threshold) {
+         status = "improved";
+      }
+      std::cout << (c.scenario.empty() ? "-" : c.scenario) << "|" << (static_cast<double>(c.failureRate) / 10.0) << "%|" << c.threadCount << "|" << before << "|" << after << "|" << change << "%|";
+      if (testable)
+         std::cout << p;
+      else
+         std::cout << "n/a";
+      std::cout << "|" << status << std::endl;
+   }
+   if (inconclusive) std::cout << "inconclusive cells need at least " << minBaselineTrials << " trials in both runs to test the slowdown" << std::endl;
+   if (missing) std::cout << "missing cells have no baseline with the same scenario, failure rate and thread count" << std::endl;
+   return !(regressed || inconclusive || missing);
+}
+
+// Fit Amdahl's law and the Universal Scalability Law to the throughput over the thread counts. Every thread performs the
+// same amount of work, thus the relative capacity is C(N) = N * T(1) / T(N). The USL predicts
+// C(N) = N / (1 + sigma * (N - 1) + kappa * N * (N - 1)), which we fit by least squares on the linearized form
+// N / C(N) - 1 = sigma * (N - 1) + kappa * N * (N - 1)
+static void analyzeScalability(const std::vector<Cell>& cells) {
+   std::cout << "scalability analysis (Universal Scalability Law)" << std::endl;
+   for (unsigned fr : failureRates) {
+      std::vector<std::pair<double, double>> points;
+      double base = 0;
+      for (auto& c : cells)
+         if (c.failureRate == fr) {
+            double t = analyzeCell(c.trials).median;
+            if (c.threadCount == 1) base = t;
+            points.push_back({c.threadCount, t});
+         }
+      std::cout << "failure rate " << (static_cast<double>(fr) / 10.0) << "%: ";
+      if ((base <= 0) || (points.size() < 3)) {
+         std::cout << "needs a measurement with 1 thread and at least 3 thread counts" << std::endl;
+         continue;
+      }
+
+      // Accumulate the normal equations
+      double s11 = 0, s12 = 0, s22 = 0, s1y = 0, s2y = 0;
+      for (auto& p : points) {
+         double n = p.first, capacity = n * base / p.second;
+         double x1 = n - 1, x2 = n * (n - 1), y = n / capacity - 1;
+         s11 += x1 * x1;
+         s12 += x1 * x2;
+         s22 += x2 * x2;
+         s1y += x1 * y;
+         s2y += x2 * y;
+      }
+      if (s11 <= 0) {
+         std::cout << "needs a measurement with more than 1 thread" << std::endl;
+         continue;
+      }
+      double amdahlSigma = std::max(s1y / s11, 0.0);
+      double det = s11 * s22 - s12 * s12;
+      double sigma = (det != 0) ? (s1y * s22 - s2y * s12) / det : amdahlSigma;
+      double kappa = (det != 0) ? (s11 * s2y - s12 * s1y) / det : 0;
+      // Refit with a single parameter if the unconstrained solution is not meaningful
+      if (kappa < 0) {
+         sigma = amdahlSigma;
+         kappa = 0;
+      } else if (sigma < 0) {
+         sigma = 0;
+         kappa = std::max(s2y / s22, 0.0);
+      }
+
+      auto capacity = [&](double n) { return n / (1 + sigma * (n - 1) + kappa * n * (n - 1)); };
+      std::cout << "USL sigma " << sigma << " kappa " << kappa;
+      if ((kappa > 0) && (sigma < 1)) {
+         double peak = std::sqrt((1 - sigma) / kappa);
+         std::cout << ", peak at " << peak << " threads with " << capacity(peak) << "x throughput";
+      } else {
+         std::cout << ", no peak";
+      }
+      std::cout << "; Amdahl sigma " << amdahlSigma;
+      if (amdahlSigma > 0) std::cout << ", at most " << (1 / amdahlSigma) << "x throughput";
+      std::cout << std::endl;
+   }
+}
+
+// Time a call that is expected to throw
+static uint64_t timeThrow(const JITContainer& jitCode) {
+   auto start = std::chrono::steady_clock::now();
+   doTest(jitCode, -1, -1);
+   auto stop = std::chrono::steady_clock::now();
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+}
+
+// Perform a few random calls, the first one of them throws. Returns the latency of the first throw
+static uint64_t doThrowSegment(const JITContainer& jitCode, Random& random, unsigned errorRate, unsigned invocations) {
+   uint64_t firstThrow = timeThrow(jitCode);
+   for (unsigned index = 1; index < invocations; ++index) {
+      auto r = random();
+      int arg = ((r % 1000) < errorRate) ? -1 : ((r & 0xFFFF) + 1);
+      doTest(jitCode, arg, expectedResult(arg));
+   }
+   return firstThrow;
+}
+
+// Thread-per-request servers constantly create threads, and each new thread has to initialize its thread-local
+// exception handling state on its first throw. Compare workers that consist of a sequence of short-lived threads with
+// long-lived workers that perform the same calls
+static void runThreadChurn(const std::vector<unsigned>& threadCounts, unsigned invocations) {
+   constexpr unsigned threadsPerWorker = 100;
+
+   // The cost of creating a thread without doing any work
+   uint64_t emptyThreadCost;
+   {
+      LatencyStats emptyThreads;
+      for (unsigned index = 0; index != 10 * threadsPerWorker; ++index) {
+         auto start = std::chrono::steady_clock::now();
+         std::thread([]() {}).join();
+         emptyThreads.add(elapsedNs(start));
+      }
+      emptyThreadCost = emptyThreads.percentile(0.5);
+   }
+
+   unsigned cell = 0;
+   std::cout << "thread churn using " << invocations << " invocations per thread, " << threadsPerWorker << " threads per worker, empty thread costs " << us(emptyThreadCost) << "us" << std::endl;
+   for (unsigned fr : failureRates) {
+      std::cout << "failure rate " << (static_cast<double>(fr) / 10.0) << "%:" << std::endl;
+      for (auto tc : threadCounts) {
+         std::vector<std::unique_ptr<JITContainer>> containers;
+         for (unsigned index = 0; index != tc; ++index) containers.push_back(std::make_unique<JITContainer>());
+         LatencyStats coldThrows, warmThrows;
+         std::mutex statsMutex;
+
+         // Run the workers either as a sequence of short-lived threads each, or as long-lived threads that perform
+         // the same calls. Returns the elapsed time
+         auto runWorkers = [&](bool churnThreads, LatencyStats& stats) {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::thread> workers;
+            for (unsigned worker = 0; worker != tc; ++worker)
+               workers.push_back(std::thread([&, worker]() {
+                  Random random(worker);
+                  LatencyStats local;
+                  for (unsigned index = 0; index != threadsPerWorker; ++index) {
+                     if (churnThreads)
+                        std::thread([&]() { local.add(doThrowSegment(*containers[worker], random, fr, invocations)); }).join();
+                     else
+                        local.add(doThrowSegment(*containers[worker], random, fr, invocations));
+                  }
+                  std::unique_lock<std::mutex> lock(statsMutex);
+                  stats.merge(local);
+               }));
+            for (auto& t : workers) t.join();
+            return elapsedNs(start);
+         };
+
+         // Warm up the caches and the lazily initialized unwinder state, and alternate the order of the runs to not
+         // favor the second one
+         LatencyStats discarded;
+         runWorkers(false, discarded);
+         double churnTime, longTime;
+         if ((cell++) % 2) {
+            longTime = runWorkers(false, warmThrows);
+            churnTime = runWorkers(true, coldThrows);
+         } else {
+            churnTime = runWorkers(true, coldThrows);
+            longTime = runWorkers(false, warmThrows);
+         }
+
+         // The extra cost per thread beyond the cost of an empty thread
+         double perThread = (churnTime - longTime) / threadsPerWorker - emptyThreadCost;
+         std::cout << "  " << tc << " workers: churn " << ms(churnTime) << "ms, long-lived " << ms(longTime) << "ms, extra per thread " << us(perThread) << "us"
+                   << ", first throw cold p50 " << us(coldThrows.percentile(0.5)) << "us p99 " << us(coldThrows.percentile(0.99)) << "us"
+                   << ", warm p50 " << us(warmThrows.percentile(0.5)) << "us p99 " << us(warmThrows.percentile(0.99)) << "us" << std::endl;
+      }
+   }
+}
+
+// Threads that map, touch and unmap anonymous memory at a given rate, like the buffer managers and allocators of other
+// subsystems do. This contends with the mprotect calls of the memory manager and the page faults of the unwinder on the
+// mmap lock of the process
+class MappingNoise {
+   std::vector<std::thread> threads;
+   std::atomic<bool> done{false};
+   std::atomic<uint64_t> mappings{0};
+   std::chrono::steady_clock::time_point start;
+
+   public:
+   // Start the given number of threads, each performing rate mappings per second
+   MappingNoise(unsigned threadCount, unsigned rate) : start(std::chrono::steady_clock::now()) {
+      for (unsigned index = 0; index != threadCount; ++index)
+         threads.push_back(std::thread([this, index, rate]() {
+            Random random(index);
+            size_t pageSize = sysconf(_SC_PAGESIZE);
+            auto next = std::chrono::steady_clock::now();
+            auto interval = std::chrono::nanoseconds(1000000000 / std::max(rate, 1u));
+            while (!done.load()) {
+               // Map between 64KB and 1MB, and fault in every page
+               size_t size = (16 + random() % 241) * 4096;
+               void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+               if (p != MAP_FAILED) {
+                  for (size_t offset = 0; offset < size; offset += pageSize) static_cast<volatile char*>(p)[offset] = 1;
+                  munmap(p, size);
+                  mappings.fetch_add(1);
+               }
+               next += interval;
+               std::this_thread::sleep_until(next);
+            }
+         }));
+   }
+   ~MappingNoise() {
+      done = true;
+      for (auto& t : threads) t.join();
+   }
+
+   // The achieved mappings per second
+   double getRate() const { return mappings.load() / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+};
+
+// Compare the compile and throw latency of the workers with and without mapping noise
+static void runMappingNoise(const std::vector<unsigned>& threadCounts, unsigned noiseThreads, unsigned rate) {
+   std::cout << "mapping noise using " << noiseThreads << " threads with " << rate << " mappings/s each" << std::endl;
+   for (unsigned fr : failureRates) {
+      std::cout << "failure rate " << (static_cast<double>(fr) / 10.0) << "%:" << std::endl;
+      for (auto tc : threadCounts) {
+         Measurements quiet, noisy;
+         double quietDuration = doTestMultithreaded(fr, tc, &quiet);
+         double noisyDuration;
+         double achieved;
+         {
+            MappingNoise noise(noiseThreads, rate);
+            noisyDuration = doTestMultithreaded(fr, tc, &noisy);
+            achieved = noise.getRate();
+         }
+         std::cout << "  " << tc << " threads: " << quietDuration << "ms, with noise " << noisyDuration << "ms (" << achieved << " mappings/s)";
+         std::cout << ", compile p50 " << us(quiet.compileLatency.percentile(0.5)) << "us p99 " << us(quiet.compileLatency.percentile(0.99)) << "us, with noise p50 " << us(noisy.compileLatency.percentile(0.5)) << "us p99 "
+                   << us(noisy.compileLatency.percentile(0.99)) << "us";
+         if (!quiet.throwLatency.samples.empty())
+            std::cout << ", throw p50 " << us(quiet.throwLatency.percentile(0.5)) << "us p99 " << us(quiet.throwLatency.percentile(0.99)) << "us, with noise p50 " << us(noisy.throwLatency.percentile(0.5)) << "us p99 "
+                      << us(noisy.throwLatency.percentile(0.99)) << "us";
+         std::cout << std::endl;
+      }
+   }
+}
+
+// Run factor times more threads than there are cores in our affinity mask. A thread that gets preempted while
+// holding the unwinder lock stalls all other threads, which shows up in the throw latency tail
+static void runOversubscription(unsigned factor) {
+   cpu_set_t mask;
+   CPU_ZERO(&mask);
+   sched_getaffinity(0, sizeof(mask), &mask);
+   unsigned cores = CPU_COUNT(&mask);
+   unsigned threadCount = cores * factor;
+
+   std::cout << "oversubscription using " << threadCount << " threads on " << cores << " cores" << std::endl;
+   for (unsigned fr : failureRates) {
+      Measurements measurements;
+      double duration = doTestMultithreaded(fr, threadCount, &measurements);
+      auto& l = measurements.throwLatency;
+      std::cout << "failure rate " << (static_cast<double>(fr) / 10.0) << "%: " << duration << "ms";
+      if (!l.samples.empty()) {
+         std::cout << ", throw latency p50 " << us(l.percentile(0.5)) << "us p99 " << us(l.percentile(0.99)) << "us p99.9 " << us(l.percentile(0.999)) << "us max " << us(l.percentile(1.0)) << "us";
+         std::cout << ", throwing thread switched voluntarily in " << measurements.throwsWithVoluntarySwitch << " and involuntarily in " << measurements.throwsWithInvoluntarySwitch << " of "
+                   << measurements.switchSampledThrows << " sampled throws";
+      }
+      std::cout << ", context switches voluntary " << measurements.voluntarySwitches << " involuntary " << measurements.involuntarySwitches << std::endl;
+   }
+}
+
+// Samples from a Zipf distribution over [0, n)
+class ZipfDistribution {
+   std::vector<double> cdf;
+
+   public:
+   ZipfDistribution(unsigned n, double skew) {
+      double sum = 0;
+      for (unsigned index = 0; index != n; ++index) cdf.push_back(sum += 1.0 / std::pow(index + 1, skew));
+      for (auto& c : cdf) c /= sum;
+   }
+   unsigned operator()(Random& random) const {
+      double u = static_cast<double>(random() >> 11) / static_cast<double>(1ull << 53);
+      return std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+   }
+};
+
+// Request code fragments following a Zipf distribution from a code cache with a limited budget, and invoke them
+static void runCacheBenchmark(const std::vector<unsigned>& threadCounts, unsigned fragments, size_t budget, double skew) {
+   constexpr unsigned requests = 1000;
+   constexpr unsigned callsPerRequest = 10;
+   constexpr unsigned errorRate = 10;
+   ZipfDistribution zipf(fragments, skew);
+
+   std::cout << "code cache with " << fragments << " fragments, zipf skew " << skew << ", budget " << budget << " bytes, " << requests << " requests per thread" << std::endl;
+   for (auto tc : threadCounts) {
+      JITCodeCache cache(budget);
+      std::vector<std::thread> threads;
+      auto start = std::chrono::steady_clock::now();
+      for (unsigned index = 0; index != tc; ++index)
+         threads.push_back(std::thread([&, index]() {
+            Random random(index);
+            for (unsigned request = 0; request != requests; ++request) {
+               auto c = std::make_unique<llvm::LLVMContext>();
+               auto m = JITContainer::generateModule(*c, zipf(random));
+               auto code = cache.get(move(c), move(m));
+               for (unsigned call = 0; call != callsPerRequest; ++call) {
+                  auto r = random();
+                  int arg = ((r % 1000) < errorRate) ? -1 : ((r & 0xFFFF) + 1);
+                  doTest(*code, arg, expectedResult(arg));
+               }
+            }
+         }));
+      for (auto& t : threads) t.join();
+      auto stop = std::chrono::steady_clock::now();
+      auto stats = cache.getStatistics();
+      std::cout << tc << " threads: " << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "ms, hits " << stats.hits << " misses " << stats.misses << " evictions " << stats.evictions
+                << ", hit rate " << (100.0 * stats.hits / (stats.hits + stats.misses)) << "%, resident " << stats.entries << " entries with " << stats.usedBytes << " bytes" << std::endl;
+   }
+}
+
+// Measure the overhead of keeping code alive on the invoke path. All threads call the same code, either directly,
+// copying a handle per call, or copying a shared_ptr per call. Meanwhile, the code is replaced regularly and a collector
+// frees the old code in batches
+static void runHandleBenchmark(const std::vector<unsigned>& threadCounts) {
+   constexpr unsigned calls = 1000000;
+   constexpr unsigned quiescentInterval = 1024;
+   constexpr unsigned replacements = 10;
+   enum Mode { Raw, Handle, SharedPtr };
+   const char* modeNames[] = {"raw", "handle copy", "shared_ptr copy"};
+
+   std::cout << "handle benchmark, " << calls << " calls per thread" << std::endl;
+   for (auto tc : threadCounts) {
+      std::cout << tc << " threads:";
+      unsigned collected = 0, batches = 0;
+      for (Mode mode : {Raw, Handle, SharedPtr}) {
+         CodeCollector::Handle current = CodeCollector::add(std::make_unique<const JITContainer>());
+         std::shared_ptr<const JITContainer> shared = std::make_shared<const JITContainer>();
+         std::mutex currentMutex;
+         std::atomic<bool> done{false};
+
+         // Replace the code regularly, and collect the old code
+         std::thread collector([&]() {
+            for (unsigned index = 0; !done.load(); ++index) {
+               std::this_thread::sleep_for(std::chrono::milliseconds(1));
+               if (index < replacements) {
+                  auto replacement = CodeCollector::add(std::make_unique<const JITContainer>());
+                  std::unique_lock<std::mutex> lock(currentMutex);
+                  current = replacement;
+               }
+               if (unsigned freed = CodeCollector::collect()) {
+                  collected += freed;
+                  ++batches;
+               }
+            }
+         });
+
+         std::vector<std::thread> threads;
+         std::atomic<uint64_t> totalNs{0};
+         for (unsigned index = 0; index != tc; ++index)
+            threads.push_back(std::thread([&, index]() {
+               CodeCollector::ThreadScope scope;
+               Random random(index);
+               CodeCollector::Handle handle;
+               {
+                  std::unique_lock<std::mutex> lock(currentMutex);
+                  handle = current;
+               }
+               auto start = std::chrono::steady_clock::now();
+               unsigned result = 0;
+               for (unsigned call = 0; call != calls; ++call) {
+                  int arg = (random() & 0xFFFF) + 1;
+                  if (mode == Raw) {
+                     result += (*handle).invoke(callback, arg);
+                  } else if (mode == Handle) {
+                     CodeCollector::Handle copy = handle;
+                     result += (*copy).invoke(callback, arg);
+                  } else {
+                     std::shared_ptr<const JITContainer> copy = shared;
+                     result += copy->invoke(callback, arg);
+                  }
+                  if (!((call + 1) % quiescentInterval)) CodeCollector::quiescentState();
+               }
+               auto stop = std::chrono::steady_clock::now();
+               if (!result) std::cerr << "invalid result!" << std::endl;
+               totalNs += std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+            }));
+         for (auto& t : threads) t.join();
+         done = true;
+         collector.join();
+         current = CodeCollector::Handle();
+         for (unsigned round = 0; round != 2; ++round)
+            if (unsigned freed = CodeCollector::collect()) {
+               collected += freed;
+               ++batches;
+            }
+         std::cout << " " << modeNames[mode] << " " << (static_cast<double>(totalNs.load()) / (static_cast<double>(calls) * tc)) << "ns";
+      }
+      std::cout << " per call, collected " << collected << " containers in " << batches << " batches" << std::endl;
+   }
+}
+
+// Run several processes that compile the same fragments, with and without sharing the compiled objects. With a name,
+// every process attaches to the named cache on its own like separate server processes would, otherwise they share the
+// anonymous cache that they inherit
+static void runSharedCacheBenchmark(unsigned processCount, size_t cacheSize, const std::string& name) {
+   constexpr unsigned fragments = 200;
+
+   // Compile all fragments in a random order in a child process. Returns the CPU time spent in all processes, or a
+   // negative value if the processes could not be started or failed
+   auto run = [&](SharedObjectCache* cache) {
+      int pipes[2];
+      if (pipe(pipes) != 0) return -1.0;
+      std::vector<pid_t> children;
+      for (unsigned process = 0; process != processCount; ++process) {
+         pid_t pid = fork();
+         if (pid < 0) {
+            // Stop the children that were already started, their results would be incomplete
+            for (pid_t child : children) kill(child, SIGKILL);
+            for (pid_t child : children) waitpid(child, nullptr, 0);
+            close(pipes[0]);
+            close(pipes[1]);
+            return -1.0;
+         }
+         if (pid == 0) {
+            close(pipes[0]);
+            std::unique_ptr<SharedObjectCache> attached;
+            if (cache && (!name.empty())) {
+               attached = std::make_unique<SharedObjectCache>(cacheSize, name);
+               if (!attached->isValid()) _exit(1);
+            }
+            JITContainer::config.objectCache = attached ? attached.get() : cache;
+            std::vector<unsigned> order(fragments);
+            for (unsigned index = 0; index != fragments; ++index) order[index] = index + 1;
+            Random random(process);
+            for (unsigned index = fragments; index > 1; --index) std::swap(order[index - 1], order[random() % index]);
+
+            timespec start, stop;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+            for (unsigned fragment : order) {
+               auto c = std::make_unique<llvm::LLVMContext>();
+               auto m = JITContainer::generateModule(*c, fragment);
+               JITContainer container(move(c), move(m));
+               sanityTest(container);
+            }
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &stop);
+            uint64_t ns = (stop.tv_sec - start.tv_sec) * 1000000000ull + stop.tv_nsec - start.tv_nsec;
+            if (write(pipes[1], &ns, sizeof(ns)) != sizeof(ns)) _exit(1);
+            _exit(0);
+         }
+         children.push_back(pid);
+      }
+      close(pipes[1]);
+      double total = 0;
+      uint64_t ns;
+      unsigned finished = 0;
+      for (; read(pipes[0], &ns, sizeof(ns)) == sizeof(ns); ++finished) total += ns;
+      close(pipes[0]);
+      for (pid_t child : children) waitpid(child, nullptr, 0);
+      return (finished == processCount) ? total / 1000000.0 : -1.0;
+   };
+
+   // Start with an empty named cache
+   if (!name.empty()) SharedObjectCache::remove(name);
+   SharedObjectCache cache(cacheSize, name);
+   if (!cache.isValid()) {
+      std::cout << "unable to create the shared object cache" << std::endl;
+      return;
+   }
+   std::cout << "shared object cache" << (name.empty() ? "" : " " + name) << ", " << processCount << " processes compiling " << fragments << " fragments each" << std::endl;
+   double without = run(nullptr);
+   double with = (without < 0) ? without : run(&cache);
+   if (!name.empty()) SharedObjectCache::remove(name);
+   if (with < 0) {
+      std::cout << "the compiling processes could not be started or failed" << std::endl;
+      return;
+   }
+   auto& stats = cache.getStatistics();
+   std::cout << "without cache " << without << "ms CPU, with cache " << with << "ms CPU, saved " << (without - with) << "ms (" << (100.0 * (without - with) / without) << "%)" << std::endl;
+   std::cout << "hits " << stats.hits.load() << " misses " << stats.misses.load() << " published " << stats.published.load() << " rejected " << stats.rejected.load() << std::endl;
+}
+
+// Initialize LLVM and compile the first code. With profiling, the startup phases are reported. With fast start, the
+// first calls are served by linking the object of the first code from the object cache, while the IR is compiled in
+// the background
+static std::unique_ptr<JITContainer> startup(std::chrono::steady_clock::time_point mainStart, double preMainCpuMs, bool profile, bool fastStart) {
+   // Everything since main, i.e., argument parsing and the configuration and precomputation of the work
+   auto configured = std::chrono::steady_clock::now();
+   std::chrono::steady_clock::time_point initStart, targetInit, irStart, irGenerated, compiled, firstCall;
+   std::unique_ptr<JITContainer> container;
+   // The time spent looking up and linking the prebuilt object with fast start, if any
+   double linkedNs = -1;
+   initStart = std::chrono::steady_clock::now();
+   llvm::InitializeNativeTarget();
+   llvm::InitializeNativeTargetAsmPrinter();
+   targetInit = std::chrono::steady_clock::now();
+   auto compile = [&](bool useObjectCache) {
+      irStart = std::chrono::steady_clock::now();
+      auto c = std::make_unique<llvm::LLVMContext>();
+      auto m = JITContainer::generateModule(*c);
+      irGenerated = std::chrono::steady_clock::now();
+      container = std::make_unique<JITContainer>(move(c), move(m), "foo", useObjectCache);
+      compiled = std::chrono::steady_clock::now();
+   };
+
+   if (!fastStart) {
+      compile(true);
+      doTest(*container, 1, expectedResult(1));
+      firstCall = std::chrono::steady_clock::now();
+   } else {
+      // Link the prebuilt object, if the cache has it, and compile the IR without the cache in the background. Otherwise
+      // the first call has to wait for the compilation, which stores the object for later runs
+      std::unique_ptr<JITContainer> linked;
+      if (auto object = JITContainer::loadCachedObject()) linked = std::make_unique<JITContainer>(move(object));
+      if (linked) linkedNs = elapsedNs(targetInit);
+      TieredFunction tier;
+      if (linked) tier.publishLinked(linked.get());
+      std::thread background([&]() {
+         compile(!linked);
+         tier.publishCompiled(container.get());
+      });
+      if (!linked) background.join();
+      uint64_t linkedCalls = 0;
+      Random random(0);
+      doTest(tier, 1, expectedResult(1));
+      firstCall = std::chrono::steady_clock::now();
+      while (!tier.isCompiled()) {
+         int arg = (random() & 0xFFFF) + 1;
+         doTest(tier, arg, expectedResult(arg));
+         ++linkedCalls;
+      }
+      if (background.joinable()) background.join();
+      if (linked)
+         std::cout << "fast start: first call after " << ms(elapsedNs(mainStart, firstCall)) << "ms using the prebuilt object (linked in " << ms(linked->getTimings().setupNs + linked->getTimings().materializeNs)
+                   << "ms), compiled code available after " << ms(elapsedNs(mainStart, compiled)) << "ms, " << linkedCalls << " calls served by the prebuilt object" << std::endl;
+      else
+         std::cout << "fast start: no prebuilt object in the cache, first call after " << ms(elapsedNs(mainStart, firstCall)) << "ms using the compiled code" << std::endl;
+   }
+
+   if (profile) {
+      auto& t = container->getTimings();
+      std::cout << "startup: pre-main " << preMainCpuMs << "ms CPU (loading and initializing LLVM), arguments and work setup " << ms(elapsedNs(mainStart, configured)) << "ms, target init " << ms(elapsedNs(initStart, targetInit)) << "ms, ";
+      if (linkedNs >= 0) std::cout << "prebuilt object lookup and link " << ms(linkedNs) << "ms, ";
+      std::cout << "IR generation " << ms(elapsedNs(irStart, irGenerated)) << "ms, JIT setup " << ms(t.setupNs) << "ms, compile and link " << ms(t.materializeNs) << "ms, first call after " << ms(elapsedNs(mainStart, firstCall)) << "ms" << std::endl;
+   }
+   return container;
+}
+
+// Compare the cost of creating a container from IR with linking a precompiled object
+static void reportContainerCreation() {
+   constexpr unsigned repeat = 100;
+   double setup[2] = {0, 0}, materialize[2] = {0, 0};
+   for (unsigned index = 0; index != repeat; ++index) {
+      JITContainer compiled;
+      JITContainer linked(llvm::MemoryBuffer::getMemBuffer(precompiledObject->getMemBufferRef(), false));
+      sanityTest(linked);
+      setup[0] += compiled.getTimings().setupNs;
+      materialize[0] += compiled.getTimings().materializeNs;
+      setup[1] += linked.getTimings().setupNs;
+      materialize[1] += linked.getTimings().materializeNs;
+   }
+   std::cout << "container creation from IR: setup " << us(setup[0] / repeat) << "us, compile and link " << us(materialize[0] / repeat) << "us; from object: setup " << us(setup[1] / repeat) << "us, link "
+             << us(materialize[1] / repeat) << "us" << std::endl;
+}
+
+// Compare code generation for the generic target, the host cpu, and the configured cpu
+static void runCpuBenchmark() {
+   constexpr unsigned compileRepeat = 20;
+   constexpr unsigned elements = 1 << 16;
+   constexpr unsigned kernelRepeat = 1000;
+   std::vector<int> data(elements);
+   for (unsigned index = 0; index != elements; ++index) data[index] = index;
+
+   auto configured = JITContainer::config;
+   std::vector<std::string> cpus{"generic", "native"};
+   if ((!configured.cpu.empty()) && (configured.cpu != "generic") && (configured.cpu != "native")) cpus.push_back(configured.cpu);
+   // The sums of squares wrap around, thus the results are unsigned
+   unsigned expected = 0;
+   for (auto& cpu : cpus) {
+      JITContainer::config.cpu = cpu;
+      double fooCompile = 0, kernelCompile = 0;
+      std::unique_ptr<JITContainer> kernel;
+      for (unsigned index = 0; index != compileRepeat; ++index) {
+         JITContainer foo;
+         fooCompile += foo.getTimings().setupNs + foo.getTimings().materializeNs;
+         auto c = std::make_unique<llvm::LLVMContext>();
+         auto m = JITContainer::generateKernel(*c);
+         kernel = std::make_unique<JITContainer>(move(c), move(m), "kernel");
+         kernelCompile += kernel->getTimings().setupNs + kernel->getTimings().materializeNs;
+      }
+
+      auto f = reinterpret_cast<int (*)(const int*, int)>(kernel->getSymbol("kernel"));
+      unsigned first = f(data.data(), elements);
+      if (!expected) expected = first;
+      if (first != expected) std::cerr << "unexpected kernel result " << first << " for cpu " << cpu << std::endl;
+      unsigned result = first;
+      auto start = std::chrono::steady_clock::now();
+      for (unsigned index = 0; index != kernelRepeat; ++index) result += f(data.data(), elements);
+      auto stop = std::chrono::steady_clock::now();
+      double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+      if (!result) std::cerr << "invalid result!" << std::endl;
+
+      std::cout << "cpu " << cpu << ((cpu == "native") ? (" (" + llvm::sys::getHostCPUName().str() + ")") : "") << ": compile foo " << (fooCompile / compileRepeat / 1000) << "us, kernel " << (kernelCompile / compileRepeat / 1000)
+                << "us, kernel throughput " << (static_cast<double>(elements) * kernelRepeat / ns) << " elements/ns" << std::endl;
+   }
+   JITContainer::config = configured;
+}
+
+// Measure compile latency and execution speed for combinations of code generation settings
+static void runCodegenBenchmark() {
+   constexpr unsigned compileRepeat = 20;
+   constexpr unsigned calls = 1000000;
+   constexpr unsigned elements = 1 << 16;
+   constexpr unsigned kernelRepeat = 100;
+   std::vector<int> data(elements);
+   for (unsigned index = 0; index != elements; ++index) data[index] = index;
+
+   auto configured = JITContainer::config;
+   const llvm::CodeGenOpt::Level levels[] = {llvm::CodeGenOpt::None, llvm::CodeGenOpt::Less, llvm::CodeGenOpt::Default, llvm::CodeGenOpt::Aggressive};
+   const char* iselNames[] = {"SelectionDAG", "FastISel", "GlobalISel"};
+   struct Row {
+      std::string settings;
+      double fooCompile, kernelCompile, callNs, kernelUs;
+   };
+   std::vector<Row> rows;
+   double baseFoo = 0, baseKernel = 0;
+   for (auto level : levels)
+      for (unsigned isel = 0; isel != 3; ++isel)
+         for (bool fastRegAlloc : {false, true}) {
+            JITContainer::config.optLevel = level;
+            JITContainer::config.fastISel = (isel == 1);
+            JITContainer::config.globalISel = (isel == 2);
+            // O0 would use FastISel unless it is explicitly disabled
+            JITContainer::setCodegenOption("fast-isel", isel ? nullptr : "false");
+            JITContainer::setFastRegisterAllocator(fastRegAlloc);
+
+            double fooCompile = 0, kernelCompile = 0;
+            std::unique_ptr<JITContainer> foo, kernel;
+            for (unsigned index = 0; index != compileRepeat; ++index) {
+               foo = std::make_unique<JITContainer>();
+               fooCompile += foo->getTimings().setupNs + foo->getTimings().materializeNs;
+               auto c = std::make_unique<llvm::LLVMContext>();
+               auto m = JITContainer::generateKernel(*c);
+               kernel = std::make_unique<JITContainer>(move(c), move(m), "kernel");
+               kernelCompile += kernel->getTimings().setupNs + kernel->getTimings().materializeNs;
+            }
+            sanityTest(*foo);
+
+            // Execute the generated code
+            Random random(0);
+            unsigned result = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned index = 0; index != calls; ++index) result += foo->invoke(callback, (random() & 0xFFFF) + 1);
+            double callNs = elapsedNs(start) / calls;
+            auto f = reinterpret_cast<int (*)(const int*, int)>(kernel->getSymbol("kernel"));
+            start = std::chrono::steady_clock::now();
+            for (unsigned index = 0; index != kernelRepeat; ++index) result += f(data.data(), elements);
+            double kernelUs = us(elapsedNs(start) / kernelRepeat);
+            if (!result) std::cerr << "invalid result!" << std::endl;
+
+            if ((level == llvm::CodeGenOpt::Default) && (!isel) && (!fastRegAlloc)) {
+               baseFoo = callNs;
+               baseKernel = kernelUs;
+            }
+            rows.push_back({"O" + std::to_string(static_cast<int>(level)) + "|" + iselNames[isel] + "|" + (fastRegAlloc ? "fast" : "default"), fooCompile / compileRepeat / 1000, kernelCompile / compileRepeat / 1000, callNs, kernelUs});
+         }
+
+   std::cout << "opt level|isel|regalloc|compile foo (us)|compile kernel (us)|call (ns)|kernel (us)|call slowdown|kernel slowdown" << std::endl;
+   for (auto& r : rows)
+      std::cout << r.settings << "|" << r.fooCompile << "|" << r.kernelCompile << "|" << r.callNs << "|" << r.kernelUs << "|" << (r.callNs / baseFoo) << "x|" << (r.kernelUs / baseKernel) << "x" << std::endl;
+   std::cout << "slowdowns are relative to O2, SelectionDAG and the default register allocator" << std::endl;
+   JITContainer::config = configured;
+   JITContainer::setCodegenOption("fast-isel", nullptr);
+   JITContainer::setFastRegisterAllocator(false);
+}
+
+// The unwinder has to find the FDE of every frame among all registered objects. Measure how the number of functions
+// per module affects the registration, the first throw, which has to classify and sort the FDEs of the new object, and
+// the steady-state throws
+static void runFunctionsBenchmark() {
+   constexpr unsigned chainLength = 4;
+   constexpr unsigned throws = 1000;
+   const unsigned functionCounts[] = {1, 10, 100, 1000, 10000};
+
+   // Call an arbitrary function of a container
+   using ChainSignature = int (*)(int (*)(int), int);
+   struct Entry {
+      ChainSignature f;
+      int invoke(int (*callback)(int), int v) const { return f(callback, v); }
+   };
+
+   std::cout << "functions|frames per throw|compile and link (ms)|register (us)|first throw (us)|steady throw (us)" << std::endl;
+   for (unsigned functions : functionCounts) {
+      unsigned repeat = std::max(3u, 300 / functions);
+      unsigned chains = (functions + chainLength - 1) / chainLength;
+      // Every throw unwinds through the generated frames of one chain, the last chain may be shorter
+      unsigned longestChain = std::min(functions, chainLength), shortestChain = functions - (chains - 1) * chainLength;
+      LatencyStats materialize, registration, firstThrows, steadyThrows;
+      Random random(functions);
+      for (unsigned index = 0; index != repeat; ++index) {
+         auto c = std::make_unique<llvm::LLVMContext>();
+         auto m = JITContainer::generateChains(*c, functions, chainLength);
+         JITContainer container(move(c), move(m), "f0");
+         materialize.add(container.getTimings().materializeNs);
+         registration.add(container.getTimings().registerNs);
+
+         // Throw through a random subset of the chains
+         auto pick = [&]() {
+            auto name = "f" + std::to_string((random() % chains) * chainLength);
+            return Entry{reinterpret_cast<ChainSignature>(container.getSymbol(name.c_str()))};
+         };
+         std::vector<Entry> entries;
+         for (unsigned e = 0; e != 16; ++e) entries.push_back(pick());
+         doTest(entries[0], 2, expectedResult(2));
+         auto start = std::chrono::steady_clock::now();
+         doTest(entries[0], -1, -1);
+         firstThrows.add(elapsedNs(start));
+         for (unsigned t = 0; t != throws / repeat + 1; ++t) {
+            start = std::chrono::steady_clock::now();
+            doTest(entries[t % entries.size()], -1, -1);
+            steadyThrows.add(elapsedNs(start));
+         }
+      }
+      std::cout << functions << "|" << shortestChain;
+      if (shortestChain != longestChain) std::cout << "-" << longestChain;
+      std::cout << "|" << ms(materialize.percentile(0.5)) << "|" << us(registration.percentile(0.5)) << "|" << us(firstThrows.percentile(0.5)) << "|" << us(steadyThrows.percentile(0.5)) << std::endl;
+   }
+   std::cout << "medians over the containers" << std::endl;
+}
+
+// libgcc keeps the registered objects in lists, thus the cost of deregistering an object and of looking up a frame
+// depends on the order of the registrations and on the addresses. Keep the given number of containers alive and
+// register and deregister their unwind info directly, in different orders
+static void runRegistrationBenchmark(unsigned containerCount) {
+   constexpr unsigned rounds = 5;
+   constexpr unsigned lookups = 1000;
+
+   std::vector<std::unique_ptr<JITContainer>> containers;
+   std::vector<uint8_t*> frames;
+   for (unsigned index = 0; index != containerCount; ++index) {
+      containers.push_back(makeContainer());
+      frames.push_back(containers.back()->getEHFrames().front());
+   }
+   unsigned ascending = 0;
+   for (unsigned index = 1; index < containerCount; ++index) ascending += frames[index] > frames[index - 1];
+   std::cout << "registration orders using " << containerCount << " containers, " << (containerCount > 1 ? 100.0 * ascending / (containerCount - 1) : 100.0) << "% of the allocations have ascending addresses" << std::endl;
+
+   // Take over the registrations of the containers, they are restored in creation order at the end
+   for (auto f : frames) __deregister_frame(f);
+
+   std::vector<unsigned> creation(containerCount);
+   for (unsigned index = 0; index != containerCount; ++index) creation[index] = index;
+   auto byAddress = creation;
+   std::sort(byAddress.begin(), byAddress.end(), [&](unsigned a, unsigned b) { return frames[a] < frames[b]; });
+   auto reversed = [](std::vector<unsigned> order) {
+      std::reverse(order.begin(), order.end());
+      return order;
+   };
+   Random random(containerCount);
+   auto shuffled = [&]() {
+      auto order = creation;
+      for (unsigned index = containerCount; index > 1; --index) std::swap(order[index - 1], order[random() % index]);
+      return order;
+   };
+
+   std::cout << "order|register p50 (us)|register p99 (us)|deregister p50 (us)|deregister p99 (us)|throw p50 (us)|throw p99 (us)" << std::endl;
+   const char* names[] = {"LIFO", "FIFO", "random", "ascending address", "descending address"};
+   double worstDeregister = 0;
+   const char* worst = names[0];
+   for (unsigned mode = 0; mode != 5; ++mode) {
+      LatencyStats registration, deregistration, throws;
+      for (unsigned round = 0; round != rounds; ++round) {
+         std::vector<unsigned> registerOrder, deregisterOrder;
+         switch (mode) {
+            case 0: registerOrder = creation, deregisterOrder = reversed(creation); break;
+            case 1: registerOrder = creation, deregisterOrder = creation; break;
+            case 2: registerOrder = shuffled(), deregisterOrder = shuffled(); break;
+            case 3: registerOrder = byAddress, deregisterOrder = byAddress; break;
+            case 4: registerOrder = reversed(byAddress), deregisterOrder = reversed(byAddress); break;
+         }
+         for (auto index : registerOrder) {
+            auto start = std::chrono::steady_clock::now();
+            __register_frame(frames[index]);
+            registration.add(elapsedNs(start));
+         }
+         // The lookups have to search among all registered objects
+         for (unsigned index = 0; index != lookups / rounds; ++index) {
+            auto start = std::chrono::steady_clock::now();
+            doTest(*containers[random() % containerCount], -1, -1);
+            throws.add(elapsedNs(start));
+         }
+         for (auto index : deregisterOrder) {
+            auto start = std::chrono::steady_clock::now();
+            __deregister_frame(frames[index]);
+            deregistration.add(elapsedNs(start));
+         }
+      }
+      double p99 = deregistration.percentile(0.99);
+      if (p99 > worstDeregister) worstDeregister = p99, worst = names[mode];
+      std::cout << names[mode] << "|" << us(registration.percentile(0.5)) << "|" << us(registration.percentile(0.99)) << "|" << us(deregistration.percentile(0.5)) << "|" << us(p99) << "|" << us(throws.percentile(0.5)) << "|" << us(throws.percentile(0.99)) << std::endl;
+   }
+   std::cout << "worst deregistration tail with " << worst << " order" << std::endl;
+
+   for (auto f : frames) __register_frame(f);
+}
+
+// Randomly interleave container creation, destruction, invocations, throws and backtraces across threads, to check that
+// the registration and reclamation of code is correct while other threads unwind nearby. The containers are shared in
+// a small pool, and released either by shared_ptr or by the code collector. Every call is checked like in doTest
+static void runStress(const std::vector<unsigned>& threadCounts, unsigned seconds) {
+   constexpr unsigned poolSize = 16;
+   enum Variant { SharedPtr, Collector };
+   const char* variantNames[] = {"shared_ptr", "collector"};
+   enum Operation { Create, Destroy, Invoke, Throw, Backtrace, OperationCount };
+   const char* operationNames[] = {"create", "destroy", "invoke", "throw", "backtrace"};
+   // The mix of the operations in percent
+   const unsigned mix[] = {5, 5, 50, 30, 10};
+
+   struct PoolSlot {
+      std::mutex mutex;
+      std::shared_ptr<const JITContainer> shared;
+      CodeCollector::Handle handle;
+   };
+   // Call a container through either kind of reference
+   struct Reference {
+      std::shared_ptr<const JITContainer> shared;
+      CodeCollector::Handle handle;
+      const JITContainer* container = nullptr;
+      int invoke(int (*cb)(int), int v) const { return container->invoke(cb, v); }
+   };
+   struct BacktraceReference {
+      const Reference& ref;
+      int invoke(int (*)(int), int v) const {
+         backtraceContainer = ref.container;
+         return ref.invoke(backtraceCallback, v);
+      }
+   };
+
+   std::cout << "stress using " << seconds << "s per run, pool of " << poolSize << " containers" << std::endl;
+   for (Variant variant : {SharedPtr, Collector})
+      for (auto tc : threadCounts) {
+         std::vector<PoolSlot> pool(poolSize);
+         for (auto& slot : pool) {
+            if (variant == SharedPtr)
+               slot.shared = makeContainer();
+            else
+               slot.handle = CodeCollector::add(makeContainer());
+         }
+         std::atomic<uint64_t> counts[OperationCount];
+         for (auto& c : counts) c = 0;
+         std::atomic<unsigned> freed{0};
+         auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+
+         std::vector<std::thread> threads;
+         for (unsigned index = 0; index != tc; ++index)
+            threads.push_back(std::thread([&, index]() {
+               CodeCollector::ThreadScope scope;
+               Random random(index);
+               uint64_t local[OperationCount] = {};
+               while (std::chrono::steady_clock::now() < deadline) {
+                  auto r = random();
+                  unsigned pick = r % 100, op = 0;
+                  while (pick >= mix[op]) pick -= mix[op++];
+                  auto& slot = pool[(r >> 8) % poolSize];
+
+                  if (op == Create) {
+                     // Replace the container of the slot, the old one is released once it is no longer used
+                     if (variant == SharedPtr) {
+                        std::shared_ptr<const JITContainer> container = makeContainer();
+                        std::unique_lock<std::mutex> lock(slot.mutex);
+                        slot.shared.swap(container);
+                     } else {
+                        auto handle = CodeCollector::add(makeContainer());
+                        std::unique_lock<std::mutex> lock(slot.mutex);
+                        slot.handle = std::move(handle);
+                     }
+                  } else if (op == Destroy) {
+                     if (variant == SharedPtr) {
+                        std::shared_ptr<const JITContainer> container;
+                        std::unique_lock<std::mutex> lock(slot.mutex);
+                        slot.shared.swap(container);
+                     } else {
+                        {
+                           std::unique_lock<std::mutex> lock(slot.mutex);
+                           slot.handle = CodeCollector::Handle();
+                        }
+                        CodeCollector::quiescentState();
+                        freed += CodeCollector::collect();
+                     }
+                  } else {
+                     // Take a reference to the code
+                     Reference ref;
+                     {
+                        std::unique_lock<std::mutex> lock(slot.mutex);
+                        if (variant == SharedPtr) {
+                           ref.shared = slot.shared;
+                           ref.container = ref.shared.get();
+                        } else if (slot.handle) {
+                           ref.handle = slot.handle;
+                           ref.container = &*ref.handle;
+                        }
+                     }
+                     if (!ref.container) continue;
+                     int arg = (op == Throw) ? -1 : static_cast<int>((r >> 32) & 0xFFFF) + 1;
+                     if (op == Backtrace)
+                        doTest(BacktraceReference{ref}, arg, expectedResult(arg));
+                     else
+                        doTest(ref, arg, expectedResult(arg));
+                  }
+                  ++local[op];
+               }
+               for (unsigned op = 0; op != OperationCount; ++op) counts[op] += local[op];
+            }));
+         for (auto& t : threads) t.join();
+
+         uint64_t total = 0;
+         for (auto& c : counts) total += c.load();
+         for (auto& slot : pool) {
+            slot.shared.reset();
+            slot.handle = CodeCollector::Handle();
+         }
+         CodeCollector::quiescentState();
+         for (unsigned round = 0; round != 2; ++round) freed += CodeCollector::collect();
+
+         std::cout << variantNames[variant] << ", " << tc << " threads: " << (static_cast<double>(total) / seconds) << " operations/s (";
+         for (unsigned op = 0; op != OperationCount; ++op) std::cout << (op ? ", " : "") << operationNames[op] << " " << counts[op].load();
+         std::cout << ")";
+         if (variant == Collector) std::cout << ", collected " << freed.load() << " containers";
+         std::cout << ", all results correct" << std::endl;
+      }
+}
+
+// A bounded lock-free multi-producer multi-consumer queue. Every cell carries a sequence number that tells producers
+// and consumers whether it is their turn, thus a position is claimed with a single CAS
+template <class T>
+class MPMCQueue {
+   struct Cell {
+      std::atomic<uint64_t> sequence;
+      T value;
+   };
+   std::vector<Cell> cells;
+   uint64_t mask;
+   alignas(64) std::atomic<uint64_t> head{0};
+   alignas(64) std::atomic<uint64_t> tail{0};
+
+   public:
+   // The capacity must be a power of two
+   explicit MPMCQueue(uint64_t capacity) : cells(capacity), mask(capacity - 1) {
+      for (uint64_t index = 0; index != capacity; ++index) cells[index].sequence.store(index, std::memory_order_relaxed);
+   }
+
+   // Returns false if the queue is full
+   bool tryPush(T&& value) {
+      uint64_t pos = tail.load(std::memory_order_relaxed);
+      while (true) {
+         auto& cell = cells[pos & mask];
+         int64_t diff = static_cast<int64_t>(cell.sequence.load(std::memory_order_acquire)) - static_cast<int64_t>(pos);
+         if (diff == 0) {
+            if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+               cell.value = std::move(value);
+               cell.sequence.store(pos + 1, std::memory_order_release);
+               return true;
+            }
+         } else if (diff < 0) {
+            return false;
+         } else {
+            pos = tail.load(std::memory_order_relaxed);
+         }
+      }
+   }
+   // Returns false if the queue is empty
+   bool tryPop(T& value) {
+      uint64_t pos = head.load(std::memory_order_relaxed);
+      while (true) {
+         auto& cell = cells[pos & mask];
+         int64_t diff = static_cast<int64_t>(cell.sequence.load(std::memory_order_acquire)) - static_cast<int64_t>(pos + 1);
+         if (diff == 0) {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+               value = std::move(cell.value);
+               cell.sequence.store(pos + mask + 1, std::memory_order_release);
+               return true;
+            }
+         } else if (diff < 0) {
+            return false;
+         } else {
+            pos = head.load(std::memory_order_relaxed);
+         }
+      }
+   }
+};
+
+// The exception that rethrowCallback throws on the current thread
+static thread_local std::exception_ptr pendingException;
+
+// A callback that rethrows the pending exception through the generated code
+static int rethrowCallback(int) {
+   std::rethrow_exception(pendingException);
+}
+
+// Parallel executors catch exceptions in their workers and rethrow them on a coordinating thread. Workers catch the
+// exceptions thrown through JIT code, ship them through a lock-free queue, and coordinators rethrow them through JIT
+// code again. Every worker waits until its error was rethrown before throwing the next one, thus the queue never holds
+// more than one error per worker and the latencies show the cost of passing an error instead of a queue backlog.
+// Measures the latency from the original throw until the coordinator caught the exception, split into throwing on the
+// worker, waiting in the queue, and rethrowing on the coordinator
+static void runExceptionTransfer(const std::vector<unsigned>& threadCounts, unsigned errors) {
+   struct Transfer {
+      std::exception_ptr exception;
+      // When the worker threw the exception, and when it queued it
+      std::chrono::steady_clock::time_point thrown, queued;
+      // Cleared by the coordinator once the exception was rethrown
+      std::atomic<bool>* pending;
+   };
+
+   std::cout << "exception transfer, " << errors << " errors per worker" << std::endl;
+   for (auto tc : threadCounts) {
+      unsigned coordinatorCount = std::max(tc / 4, 1u);
+      uint64_t capacity = 1;
+      while (capacity < tc) capacity *= 2;
+      MPMCQueue<Transfer> queue(capacity);
+      std::unique_ptr<std::atomic<bool>[]> pending(new std::atomic<bool>[tc]);
+      for (unsigned index = 0; index != tc; ++index) pending[index] = false;
+      std::atomic<uint64_t> received{0};
+      uint64_t total = static_cast<uint64_t>(errors) * tc;
+      LatencyStats local, waiting, rethrows, propagation;
+      std::mutex statsMutex;
+
+      // The threads compile their code before the measurement starts
+      std::atomic<unsigned> ready{0};
+      std::atomic<bool> go{false};
+      auto startTogether = [&]() {
+         ++ready;
+         while (!go.load()) std::this_thread::yield();
+      };
+
+      std::vector<std::thread> threads;
+      for (unsigned index = 0; index != tc; ++index)
+         threads.push_back(std::thread([&, index]() {
+            JITContainer container;
+            LatencyStats throws;
+            startTogether();
+            for (unsigned e = 0; e != errors; ++e) {
+               Transfer t{nullptr, std::chrono::steady_clock::now(), {}, &pending[index]};
+               try {
+                  container.invoke(callback, -1);
+               } catch (...) {
+                  t.exception = std::current_exception();
+               }
+               t.queued = std::chrono::steady_clock::now();
+               throws.add(elapsedNs(t.thrown, t.queued));
+               pending[index].store(true, std::memory_order_relaxed);
+               while (!queue.tryPush(std::move(t))) std::this_thread::yield();
+               while (pending[index].load(std::memory_order_acquire)) std::this_thread::yield();
+            }
+            std::unique_lock<std::mutex> lock(statsMutex);
+            local.merge(throws);
+         }));
+      for (unsigned index = 0; index != coordinatorCount; ++index)
+         threads.push_back(std::thread([&]() {
+            JITContainer container;
+            LatencyStats waits, rethrowLatencies, latencies;
+            Transfer t;
+            startTogether();
+            while (received.load() < total) {
+               if (!queue.tryPop(t)) {
+                  std::this_thread::yield();
+                  continue;
+               }
+               ++received;
+               auto popped = std::chrono::steady_clock::now();
+               pendingException = std::move(t.exception);
+               try {
+                  container.invoke(rethrowCallback, 0);
+                  std::cerr << "rethrow did not throw!" << std::endl;
+                  exit(1);
+               } catch (int v) {
+                  if (v != -1) {
+                     std::cerr << "unexpected exception " << v << std::endl;
+                     exit(1);
+                  }
+               }
+               pendingException = nullptr;
+               auto caught = std::chrono::steady_clock::now();
+               waits.add(elapsedNs(t.queued, popped));
+               rethrowLatencies.add(elapsedNs(popped, caught));
+               latencies.add(elapsedNs(t.thrown, caught));
+               t.pending->store(false, std::memory_order_release);
+            }
+            std::unique_lock<std::mutex> lock(statsMutex);
+            waiting.merge(waits);
+            rethrows.merge(rethrowLatencies);
+            propagation.merge(latencies);
+         }));
+      while (ready.load() != tc + coordinatorCount) std::this_thread::yield();
+      auto start = std::chrono::steady_clock::now();
+      go = true;
+      for (auto& t : threads) t.join();
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      std::cout << tc << " workers, " << coordinatorCount << " coordinators: " << (total / seconds) << " errors/s, worker throw and catch p50 " << us(local.percentile(0.5)) << "us p99 " << us(local.percentile(0.99))
+                << "us, queue wait p50 " << us(waiting.percentile(0.5)) << "us p99 " << us(waiting.percentile(0.99)) << "us, coordinator rethrow p50 " << us(rethrows.percentile(0.5)) << "us p99 "
+                << us(rethrows.percentile(0.99)) << "us, end-to-end p50 " << us(propagation.percentile(0.5)) << "us p99 " << us(propagation.percentile(0.99)) << "us" << std::endl;
+   }
+}
+
+// Turn a division by zero in the generated code into an exception. The signal frame has unwind info, and the generated
+// code has asynchronous unwind tables, thus the unwinder can continue from the faulting instruction. The signal is not
+// blocked in the handler, as we never return from it
+static void divisionHandler(int) {
+   throw -1;
+}
+
+// Compare generated code that lets the cpu trap on division by zero with code that checks explicitly and throws
+static void runDivisionBenchmark(const std::vector<unsigned>& threadCounts) {
+   constexpr unsigned calls = 100000;
+   struct sigaction action;
+   memset(&action, 0, sizeof(action));
+   action.sa_handler = divisionHandler;
+   action.sa_flags = SA_NODEFER;
+   sigemptyset(&action.sa_mask);
+   sigaction(SIGFPE, &action, nullptr);
+
+   // Call the division code, the result for input v is the result of the callback for 65536 / v
+   struct Division {
+      const JITContainer& container;
+      int invoke(int (*cb)(int), int v) const { return container.invoke(cb, v); }
+      static int expected(int v) { return v ? expectedResult(65536 / v) : -1; }
+   };
+   auto run = [&](bool explicitCheck, unsigned fr, unsigned tc) {
+      std::vector<std::unique_ptr<JITContainer>> containers;
+      for (unsigned index = 0; index != tc; ++index) {
+         auto c = std::make_unique<llvm::LLVMContext>();
+         auto m = JITContainer::generateDivision(*c, explicitCheck);
+         containers.push_back(std::make_unique<JITContainer>(std::move(c), std::move(m)));
+         doTest(Division{*containers.back()}, 0, -1);
+      }
+      auto start = std::chrono::steady_clock::now();
+      std::vector<std::thread> threads;
+      for (unsigned index = 0; index != tc; ++index)
+         threads.push_back(std::thread([&, index]() {
+            Random random(index);
+            Division division{*containers[index]};
+            for (unsigned call = 0; call != calls; ++call) {
+               auto r = random();
+               int arg = ((r % 1000) < fr) ? 0 : ((r & 0xFFFF) + 1);
+               doTest(division, arg, Division::expected(arg));
+            }
+         }));
+      for (auto& t : threads) t.join();
+      return ms(elapsedNs(start));
+   };
+
+   std::cout << "division by zero using";
+   for (auto c : threadCounts) std::cout << " " << c;
+   std::cout << " threads, " << calls << " calls per thread, trap|check in ms" << std::endl;
+   for (unsigned fr : failureRates) {
+      std::cout << "failure rate " << (static_cast<double>(fr) / 10.0) << "%:";
+      for (auto tc : threadCounts) {
+         std::cout << " " << run(false, fr, tc) << "|" << run(true, fr, tc);
+         std::cout.flush();
+      }
+      std::cout << std::endl;
+   }
+   signal(SIGFPE, SIG_DFL);
+}
+
+// Compare the compile throughput with private contexts, a single shared context, and a pool of shared contexts
+static void runContextBenchmark(const std::vector<unsigned>& threadCounts, unsigned shards) {
+   constexpr unsigned compiles = 50;
+   unsigned configured = ContextPool::size();
+   std::cout << "context benchmark, " << compiles << " compiles per thread, " << shards << " shards" << std::endl;
+   std::cout << "threads|private (compiles/s)|shared (compiles/s)|shared lock wait (us/compile)|sharded (compiles/s)|sharded lock wait (us/compile)" << std::endl;
+   for (auto tc : threadCounts) {
+      std::cout << tc;
+      for (unsigned poolSize : {0u, 1u, shards}) {
+         ContextPool::configure(poolSize);
+         ContextPool::reset();
+         auto start = std::chrono::steady_clock::now();
+         std::vector<std::thread> threads;
+         for (unsigned index = 0; index != tc; ++index)
+            threads.push_back(std::thread([]() {
+               for (unsigned c = 0; c != compiles; ++c) {
+                  JITContainer container;
+                  doTest(container, 2, expectedResult(2));
+               }
+            }));
+         for (auto& t : threads) t.join();
+         double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+         std::cout << "|" << (tc * compiles / seconds);
+         if (poolSize) std::cout << "|" << (ContextPool::getWaitNs() / 1000.0 / (tc * compiles));
+         std::cout.flush();
+      }
+      std::cout << std::endl;
+   }
+   ContextPool::configure(configured);
+   ContextPool::reset();
+}
+
+static std::vector<unsigned> buildThreadCounts(unsigned maxCount) {
+   std::vector<unsigned> threadCounts{1};
+   while (threadCounts.back() < maxCount) threadCounts.push_back(std::min(threadCounts.back() * 2, maxCount));
+   return threadCounts;
+}
+
+// Interpret a list of numbers separated by spaces
+static std::vector<unsigned> interpretNumbers(std::string desc) {
+   std::vector<unsigned> numbers;
+   auto add = [&](const std::string& desc) {
+      if (desc.find_first_not_of(' ') != std::string::npos) numbers.push_back(std::stoi(desc));
+   };
+   while (desc.find(' ') != std::string::npos) {
+      auto split = desc.find(' ');
+      add(desc.substr(0, split));
+      desc = desc.substr(split + 1);
+   }
+   add(desc);
+   return numbers;
+}
+
+static std::vector<unsigned> interpretThreadCounts(std::string desc) {
+   auto threadCounts = interpretNumbers(desc);
+   threadCounts.erase(std::remove(threadCounts.begin(), threadCounts.end(), 0u), threadCounts.end());
+   return threadCounts;
+}
+
+// Interpret a cpu list like "0-3,8" and restrict the process to these cpus
+static bool setAffinity(const std::string& desc) {
+   cpu_set_t mask;
+   CPU_ZERO(&mask);
+   size_t pos = 0;
+   while (pos < desc.size()) {
+      auto end = desc.find(',', pos);
+      if (end == std::string::npos) end = desc.size();
+      auto range = desc.substr(pos, end - pos);
+      auto dash = range.find('-');
+      unsigned from = std::stoi(range.substr(0, dash)), to = (dash == std::string::npos) ? from : std::stoi(range.substr(dash + 1));
+      for (unsigned cpu = from; cpu <= to; ++cpu) CPU_SET(cpu, &mask);
+      pos = end + 1;
+   }
+   return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+}
+
+// The parameters of the test matrix. They can be given on the command line, or for multiple named workloads in a
+// scenario file
+struct Workload {
+   std::string name;
+   std::vector<unsigned> threadCounts = buildThreadCounts(std::thread::hardware_concurrency() / 2); // assuming half are hyperthreads
+   std::vector<unsigned> failureRates = {0, 1, 10, 100};
+   unsigned trials = 1, warmup = 0;
+   std::string work = "1";
+   size_t workingSet = 0;
+   unsigned containers = 1;
+   bool randomPick = false;
+   std::string cpus;
+};
+
+// The options that describe a workload. On the command line they are prefixed with --
+static bool isWorkloadOption(const std::string& key) {
+   static const char* options[] = {"threads", "failure-rates", "trials", "warmup", "work", "working-set", "containers", "pick", "cpus"};
+   for (auto o : options)
+      if (key == o) return true;
+   return false;
+}
+
+// Set an option of a workload. Returns false if the value is invalid
+static bool parseWorkloadOption(Workload& workload, const std::string& key, const std::string& value) {
+   if (key == "threads") {
+      workload.threadCounts = interpretThreadCounts(value);
+   } else if (key == "failure-rates") {
+      workload.failureRates = interpretNumbers(value);
+   } else if (key == "trials") {
+      workload.trials = std::max(std::stoi(value), 1);
+   } else if (key == "warmup") {
+      workload.warmup = std::stoi(value);
+   } else if (key == "work") {
+      workload.work = value;
+   } else if (key == "working-set") {
+      workload.workingSet = std::stoull(value);
+   } else if (key == "containers") {
+      workload.containers = std::max(std::stoi(value), 1);
+   } else if (key == "pick") {
+      if ((value != "rr") && (value != "random")) {
+         std::cout << "unknown pick strategy " << value << std::endl;
+         return false;
+      }
+      workload.randomPick = (value == "random");
+   } else if (key == "cpus") {
+      workload.cpus = value;
+   } else {
+      return false;
+   }
+   return true;
+}
+
+// Read the workloads of a scenario file. Every workload starts with a [name] line followed by key = value lines, where
+// the keys are the workload options. Options that are not given are taken from the defaults
+static bool readScenarios(const std::string& file, const Workload& defaults, std::vector<Workload>& workloads) {
+   std::ifstream in(file);
+   if (!in) {
+      std::cout << "unable to read scenarios " << file << std::endl;
+      return false;
+   }
+   auto trim = [](const std::string& s) {
+      auto begin = s.find_first_not_of(" \t\r"), end = s.find_last_not_of(" \t\r");
+      return (begin == std::string::npos) ? std::string() : s.substr(begin, end - begin + 1);
+   };
+   std::string line;
+   for (unsigned lineNo = 1; std::getline(in, line); ++lineNo) {
+      line = trim(line);
+      if (line.empty() || (line[0] == '#') || (line[0] == ';')) continue;
+      if ((line[0] == '[') && (line.back() == ']')) {
+         workloads.push_back(defaults);
+         workloads.back().name = trim(line.substr(1, line.size() - 2));
+         continue;
+      }
+      auto split = line.find('=');
+      std::string key = trim(line.substr(0, split));
+      if ((split == std::string::npos) || workloads.empty() || (!isWorkloadOption(key))) {
+         std::cout << file << ":" << lineNo << ": expected [name] or an option = value line" << std::endl;
+         return false;
+      }
+      if (!parseWorkloadOption(workloads.back(), key, trim(line.substr(split + 1)))) return false;
+   }
+   return true;
+}
+
+// Apply the settings of a workload to the test
+static bool applyWorkload(const Workload& workload) {
+   failureRates = workload.failureRates;
+   liveContainers = workload.containers;
+   randomPick = workload.randomPick;
+
+   // Restrict the process to the cpus of the workload, or restore the initial mask
+   static cpu_set_t initialMask;
+   static bool captured = false;
+   if (!captured) {
+      sched_getaffinity(0, sizeof(initialMask), &initialMask);
+      captured = true;
+   }
+   if (workload.cpus.empty()) {
+      sched_setaffinity(0, sizeof(initialMask), &initialMask);
+   } else if (!setAffinity(workload.cpus)) {
+      std::cout << "unable to set cpu affinity " << workload.cpus << std::endl;
+      return false;
+   }
+
+   // Configure the work per call, either as Collatz steps or as time per call
+   size_t end;
+   double amount = std::stod(workload.work, &end);
+   auto unit = workload.work.substr(end);
+   if ((unit == "ns") || (unit == "us") || (unit == "ms")) {
+      unsigned iterations = calibrateWork(amount * ((unit == "ns") ? 1 : ((unit == "us") ? 1000 : 1000000)));
+      std::cout << "using " << iterations << " Collatz steps per call for " << workload.work << " of work" << std::endl;
+      setWork(iterations, workload.workingSet);
+   } else {
+      setWork(amount, workload.workingSet);
+   }
+   return true;
+}
+
+int main(int argc, char* argv[]) {
+   // Everything before main is mostly spent loading and initializing LLVM
+   auto mainStart = std::chrono::steady_clock::now();
+   double preMainCpuMs;
+   {
+      rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+      preMainCpuMs = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+   }
+
+   // Handle arguments
+   Workload workload;
+   std::string scenarioFile;
+   unsigned oversubscription = 0, churn = 0;
+   std::string outputFile, baselineFile;
+   double threshold = 10;
+   bool usl = false;
+   unsigned cacheFragments = 0;
+   size_t cacheBudget = 1 << 20;
+   double zipfSkew = 1.0;
+   bool handleBench = false;
+   unsigned sharedCacheProcesses = 0;
+   size_t sharedCacheSize = 64 << 20;
+   std::string sharedCacheName;
+   bool sharedCacheUnlink = false;
+   std::unique_ptr<SharedObjectCache> sharedCache;
+   bool startupProfile = false, fastStart = false;
+   std::unique_ptr<DiskObjectCache> diskCache;
+   bool precompiled = false, cpuBench = false, codegenBench = false, fastRegAlloc = false, functionsBench = false;
+   unsigned registrationBench = 0;
+   unsigned mappingNoise = 0, noiseThreads = 1;
+   unsigned watchdogMs = 0;
+   unsigned stressSeconds = 0;
+   unsigned transferErrors = 0;
+   bool divisionBench = false;
+   unsigned contexts = 0;
+   bool contextBench = false;
+   bool watchdogStacks = false;
+   std::string objectFile;
+   for (int index = 1; index < argc; ++index) {
+      std::string o = argv[index];
+      if ((o.compare(0, 2, "--") == 0) && isWorkloadOption(o.substr(2)) && (index + 1 < argc)) {
+         if (!parseWorkloadOption(workload, o.substr(2), argv[++index])) return 1;
+      } else if ((o == "--scenarios") && (index + 1 < argc)) {
+         scenarioFile = argv[++index];
+      } else if ((o == "--oversubscribe") && (index + 1 < argc)) {
+         int factor = std::stoi(argv[++index]);
+         if (factor < 1) {
+            std::cout << "invalid oversubscription factor " << factor << std::endl;
+            return 1;
+         }
+         oversubscription = factor;
+      } else if ((o == "--output") && (index + 1 < argc)) {
+         outputFile = argv[++index];
+      } else if ((o == "--baseline") && (index + 1 < argc)) {
+         baselineFile = argv[++index];
+      } else if ((o == "--threshold") && (index + 1 < argc)) {
+         threshold = std::stod(argv[++index]);
+      } else if ((o == "--cache-bench") && (index + 1 < argc)) {
+         cacheFragments = std::max(std::stoi(argv[++index]), 1);
+      } else if ((o == "--cache-budget") && (index + 1 < argc)) {
+         cacheBudget = std::stoull(argv[++index]);
+      } else if ((o == "--zipf") && (index + 1 < argc)) {
+         zipfSkew = std::stod(argv[++index]);
+      } else if (o == "--handle-bench") {
+         handleBench = true;
+      } else if ((o == "--shared-cache-bench") && (index + 1 < argc)) {
+         sharedCacheProcesses = std::max(std::stoi(argv[++index]), 1);
+      } else if ((o == "--shared-cache-size") && (index + 1 < argc)) {
+         sharedCacheSize = std::stoull(argv[++index]);
+      } else if ((o == "--shared-cache-name") && (index + 1 < argc)) {
+         sharedCacheName = argv[++index];
+      } else if (o == "--shared-cache-unlink") {
+         sharedCacheUnlink = true;
+      } else if (o == "--startup-profile") {
+         startupProfile = true;
+      } else if (o == "--fast-start") {
+         fastStart = true;
+      } else if ((o == "--object-cache") && (index + 1 < argc)) {
+         diskCache = std::make_unique<DiskObjectCache>(argv[++index]);
+         JITContainer::config.objectCache = diskCache.get();
+      } else if (o == "--precompiled") {
+         precompiled = true;
+      } else if ((o == "--object") && (index + 1 < argc)) {
+         objectFile = argv[++index];
+         precompiled = true;
+      } else if ((o == "--cpu") && (index + 1 < argc)) {
+         JITContainer::config.cpu = argv[++index];
+      } else if ((o == "--features") && (index + 1 < argc)) {
+         std::string features = argv[++index];
+         for (size_t pos = 0; pos < features.size();) {
+            auto end = std::min(features.find(',', pos), features.size());
+            if (end > pos) JITContainer::config.features.push_back(features.substr(pos, end - pos));
+            pos = end + 1;
+         }
+      } else if ((o == "--opt-level") && (index + 1 < argc)) {
+         JITContainer::config.optLevel = static_cast<llvm::CodeGenOpt::Level>(std::min(std::max(std::stoi(argv[++index]), 0), 3));
+      } else if ((o == "--isel") && (index + 1 < argc)) {
+         std::string isel = argv[++index];
+         if ((isel != "sdag") && (isel != "fast") && (isel != "global")) {
+            std::cout << "unknown instruction selector " << isel << std::endl;
+            return 1;
+         }
+         JITContainer::config.fastISel = (isel == "fast");
+         JITContainer::config.globalISel = (isel == "global");
+      } else if ((o == "--regalloc") && (index + 1 < argc)) {
+         std::string regalloc = argv[++index];
+         if ((regalloc != "default") && (regalloc != "fast")) {
+            std::cout << "unknown register allocator " << regalloc << std::endl;
+            return 1;
+         }
+         fastRegAlloc = (regalloc == "fast");
+      } else if (o == "--size-report") {
+         JITContainer::config.accountSizes = true;
+      } else if (o == "--time-passes") {
+         JITContainer::config.timePasses = true;
+      } else if ((o == "--contexts") && (index + 1 < argc)) {
+         contexts = std::stoi(argv[++index]);
+      } else if (o == "--context-bench") {
+         contextBench = true;
+      } else if (o == "--sigfpe-bench") {
+         divisionBench = true;
+      } else if ((o == "--exception-transfer") && (index + 1 < argc)) {
+         transferErrors = std::max(std::stoi(argv[++index]), 1);
+      } else if ((o == "--stress") && (index + 1 < argc)) {
+         stressSeconds = std::stoi(argv[++index]);
+      } else if ((o == "--watchdog") && (index + 1 < argc)) {
+         watchdogMs = std::max(std::stoi(argv[++index]), 1);
+      } else if (o == "--watchdog-stacks") {
+         watchdogStacks = true;
+      } else if ((o == "--mmap-noise") && (index + 1 < argc)) {
+         mappingNoise = std::stoi(argv[++index]);
+      } else if ((o == "--noise-threads") && (index + 1 < argc)) {
+         noiseThreads = std::max(std::stoi(argv[++index]), 1);
+      } else if ((o == "--registration-bench") && (index + 1 < argc)) {
+         registrationBench = std::stoi(argv[++index]);
+      } else if (o == "--functions-bench") {
+         functionsBench = true;
+      } else if (o == "--codegen-bench") {
+         codegenBench = true;
+      } else if (o == "--cpu-bench") {
+         cpuBench = true;
+      } else if (o == "--usl") {
+         usl = true;
+      } else if ((o == "--churn") && (index + 1 < argc)) {
+         churn = std::max(std::stoi(argv[++index]), 1);
+      } else {
+         std::cout << "unknown option " << o << std::endl;
+         return 1;
+      }
+   }
+
+   // Share the compiled objects with other processes through the named cache, unless it is benchmarked
+   if ((!sharedCacheName.empty()) && (!sharedCacheProcesses)) {
+      if (diskCache) {
+         std::cout << "--shared-cache-name and --object-cache cannot be combined" << std::endl;
+         return 1;
+      }
+      sharedCache = std::make_unique<SharedObjectCache>(sharedCacheSize, sharedCacheName);
+      if (!sharedCache->isValid()) {
+         std::cout << "unable to attach to the shared object cache " << sharedCacheName << std::endl;
+         return 1;
+      }
+      JITContainer::config.objectCache = sharedCache.get();
+   }
+   if (fastStart && (!JITContainer::config.objectCache)) {
+      std::cout << "--fast-start needs an --object-cache or a --shared-cache-name to link the first code from" << std::endl;
+      return 1;
+   }
+
+   std::vector<Cell> baseline;
+   if ((!baselineFile.empty()) && (!readResults(baselineFile, baseline))) {
+      std::cout << "unable to read baseline " << baselineFile << std::endl;
+      return 1;
+   }
+
+   std::vector<Workload> scenarios;
+   if ((!scenarioFile.empty()) && (!readScenarios(scenarioFile, workload, scenarios))) return 1;
+   if (!baselineFile.empty()) {
+      bool enoughTrials = scenarios.empty() ? (workload.trials >= minBaselineTrials) : std::all_of(scenarios.begin(), scenarios.end(), [](const Workload& s) { return s.trials >= minBaselineTrials; });
+      if (!enoughTrials) {
+         std::cout << "comparing with a baseline needs at least " << minBaselineTrials << " trials per cell, use --trials" << std::endl;
+         return 1;
+      }
+   }
+
+   // Configure the work per call and the placement
+   if (!applyWorkload(workload)) return 1;
+
+   // Init llvm
+   JITContainer::setFastRegisterAllocator(fastRegAlloc);
+   auto container = startup(mainStart, preMainCpuMs, startupProfile, fastStart);
+
+   // Sanity tests
+   sanityTest(*container);
+
+   // Load or compile the object that replaces compilation in the tests
+   if (precompiled) {
+      if (!objectFile.empty()) {
+         auto buffer = llvm::MemoryBuffer::getFile(objectFile);
+         if (!buffer) {
+            std::cout << "unable to read " << objectFile << std::endl;
+            return 1;
+         }
+         precompiledObject = std::move(*buffer);
+      } else {
+         precompiledObject = JITContainer::compileObject();
+      }
+      reportContainerCreation();
+   }
+
+   // Share the contexts of the modules if requested
+   if (contexts) ContextPool::configure(contexts);
+   ContextPool::reset();
+
+   // Multi-rhreaded tests
+   int exitCode = 0;
+   if (watchdogMs) Watchdog::start(watchdogMs, watchdogStacks);
+   if (oversubscription)
+      runOversubscription(oversubscription);
+   else if (churn)
+      runThreadChurn(workload.threadCounts, churn);
+   else if (contextBench)
+      runContextBenchmark(workload.threadCounts, contexts ? contexts : 4);
+   else if (divisionBench)
+      runDivisionBenchmark(workload.threadCounts);
+   else if (transferErrors)
+      runExceptionTransfer(workload.threadCounts, transferErrors);
+   else if (stressSeconds)
+      runStress(workload.threadCounts, stressSeconds);
+   else if (mappingNoise)
+      runMappingNoise(workload.threadCounts, noiseThreads, mappingNoise);
+   else if (functionsBench)
+      runFunctionsBenchmark();
+   else if (registrationBench)
+      runRegistrationBenchmark(registrationBench);
+   else if (codegenBench)
+      runCodegenBenchmark();
+   else if (cpuBench)
+      runCpuBenchmark();
+   else if (sharedCacheProcesses)
+      runSharedCacheBenchmark(sharedCacheProcesses, sharedCacheSize, sharedCacheName);
+   else if (handleBench)
+      runHandleBenchmark(workload.threadCounts);
+   else if (cacheFragments)
+      runCacheBenchmark(workload.threadCounts, cacheFragments, cacheBudget, zipfSkew);
+   else {
+      std::vector<Cell> cells;
+      if (scenarios.empty()) {
+         cells = runTests(workload.threadCounts, workload.trials, workload.warmup);
+         if (usl) analyzeScalability(cells);
+      }
+      // Run the scenarios one after the other, and tag their cells
+      for (auto& s : scenarios) {
+         std::cout << "scenario " << s.name << std::endl;
+         if (!applyWorkload(s)) return 1;
+         auto scenarioCells = runTests(s.threadCounts, s.trials, s.warmup);
+         if (usl) analyzeScalability(scenarioCells);
+         for (auto& c : scenarioCells) {
+            c.scenario = s.name;
+            cells.push_back(std::move(c));
+         }
+      }
+      if ((!outputFile.empty()) && (!writeResults(outputFile, cells))) {
+         std::cout << "unable to write " << outputFile << std::endl;
+         return 1;
+      }
+      if ((!baselineFile.empty()) && (!compareWithBaseline(baseline, cells, threshold))) exitCode = 2;
+   }
+
+   if (watchdogMs) {
+      Watchdog::stop();
+      Watchdog::report();
+   }
+   if (JITContainer::config.timePasses) PassTimings::report(10);
+   if (JITContainer::config.accountSizes) CodeSizes::report();
+   if (contexts && (!contextBench)) ContextPool::report();
+   if (sharedCache) {
+      auto& stats = sharedCache->getStatistics();
+      std::cout << "shared object cache " << sharedCacheName << ", over all attached processes: hits " << stats.hits.load() << " misses " << stats.misses.load() << " published " << stats.published.load() << " rejected " << stats.rejected.load() << std::endl;
+      if (sharedCacheUnlink) SharedObjectCache::remove(sharedCacheName);
+   }
+   return exitCode;
 }